@@ -41,6 +41,7 @@
 
 #include "core.h"
 #include "card.h"
+#include "cqe.h"
 #include "host.h"
 
 #include "pwrseq.h"
@@ -170,7 +171,7 @@ static inline void mmc_bus_put(struct mmc_host *host)
  * Internal function that does the actual ios call to the host driver,
  * optionally printing some debug output.
  */
-static inline void mmc_set_ios(struct mmc_host *host)
+void mmc_set_ios(struct mmc_host *host)
 {
         struct mmc_ios *ios = &host->ios;
 
@@ -212,6 +213,7 @@ void mmc_set_initial_state(struct mmc_host *host)
                 host->cqe_ops->cqe_off(host);
 
         mmc_retune_disable(host);
+        mmc_clk_scale_reset(host);
 
         if (mmc_host_is_spi(host))
                 host->ios.chip_select = MMC_CS_HIGH;
@@ -464,6 +466,8 @@ static void __mmc_start_request(struct mmc_host *host, struct mmc_request *mrq)
         int err;
 
         /* Assumes host controller has been runtime resumed by mmc_claim_host */
+        mmc_clk_scale_account(host, mrq);
+
         err = mmc_retune(host);
         if (err) {
                 mrq->cmd->error = err; 
@@ -652,6 +656,722 @@ int mmc_wait_for_cmd(struct mmc_host *host, struct mmc_command *cmd, int retries
 
 EXPORT_SYMBOL(mmc_wait_for_cmd);
 
+/*
+ * Command queue engine (CQE) requests. Data transfers carry a tag from
+ * mmc_cqe_get_tag() and may be queued up to host->cqe_qdepth deep, a
+ * request with a cmd goes to the engine's direct command (DCMD) slot.
+ * The caller keeps the host claimed while anything is queued; a task
+ * error halts the engine, and the recovery it needs is run from that
+ * caller's context by the next mmc_cqe_start_req() or
+ * mmc_cqe_wait_for_idle().
+ */
+
+/**
+ *      mmc_cqe_get_tag - allocate a CQE task tag
+ *      @host: MMC host
+ *
+ *      Returns a free tag below host->cqe_qdepth, or -EBUSY if every
+ *      slot is in use. Lockless: the search starts after the tag handed
+ *      out last, so concurrent callers rarely race for the same bit, and
+ *      a lost race simply moves on to the next free one.
+ */
+int mmc_cqe_get_tag(struct mmc_host *host)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+        unsigned int depth = host->cqe_qdepth;
+        unsigned int hint = READ_ONCE(core->cqe_tag_hint);
+        bool wrapped = !hint;
+        unsigned int tag;
+
+        for (;;) {
+                tag = find_next_zero_bit(&core->cqe_tags, depth, hint);
+                if (tag >= depth) {
+                        if (wrapped)
+                                return -EBUSY;
+                        wrapped = true;
+                        hint = 0;
+                        continue;
+                }
+                if (!test_and_set_bit_lock(tag, &core->cqe_tags))
+                        break;
+                hint = tag + 1;
+        }
+
+        WRITE_ONCE(core->cqe_tag_hint, tag + 1 < depth ? tag + 1 : 0);
+
+        return tag;
+}
+EXPORT_SYMBOL(mmc_cqe_get_tag);
+
+/**
+ *      mmc_cqe_put_tag - free a CQE task tag
+ *      @host: MMC host
+ *      @tag: tag from mmc_cqe_get_tag()
+ */
+void mmc_cqe_put_tag(struct mmc_host *host, int tag)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        WARN_ON(!test_bit(tag, &core->cqe_tags));
+        clear_bit_unlock(tag, &core->cqe_tags);
+}
+EXPORT_SYMBOL(mmc_cqe_put_tag);
+
+/*
+ * CQE scheduling. Reads are latency sensitive: while writes are queued
+ * they go out with the priority bit so that the card serves them ahead of
+ * those. With nothing to overtake the bit is left alone, as CQE drivers
+ * also take it to mean "complete without interrupt coalescing". Bulk
+ * writes are not: only cqe_bulk_max of them may be queued, so that a
+ * read never waits behind a full queue of them, and the caller retries
+ * the rest once requests complete. Ordering points reach the engine as a
+ * DCMD, which it queues as a barrier, instead of draining the queue. The
+ * core never sets MMC_DATA_QBR itself; a write that carries it is not
+ * held back.
+ */
+static int mmc_cqe_admit(struct mmc_host *host, struct mmc_request *mrq)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+        struct mmc_data *data = mrq->data;
+
+        if (!data)
+                return 0;
+
+        if (!core->cqe_sched)
+                return 0;
+
+        if (data->flags & MMC_DATA_READ) {
+                if (atomic_read(&core->cqe_writes))
+                        data->flags |= MMC_DATA_PRIO;
+                return 0;
+        }
+
+        if (core->cqe_bulk_max &&
+            !(data->flags & (MMC_DATA_PRIO | MMC_DATA_QBR)) &&
+            data->blksz * data->blocks >= core->cqe_bulk_bytes) {
+                if (atomic_inc_return(&core->cqe_bulk_writes) >
+                    core->cqe_bulk_max) {
+                        atomic_dec(&core->cqe_bulk_writes);
+                        core->cqe_throttled++;
+                        return -EBUSY;
+                }
+                data->flags |= MMC_DATA_BULK;
+        }
+
+        atomic_inc(&core->cqe_writes);
+        data->flags |= MMC_DATA_QUEUED;
+
+        return 0;
+}
+
+static void mmc_cqe_release(struct mmc_host *host, struct mmc_request *mrq)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+        struct mmc_data *data = mrq->data;
+
+        if (!data)
+                return;
+
+        if (data->flags & MMC_DATA_BULK) {
+                data->flags &= ~MMC_DATA_BULK;
+                atomic_dec(&core->cqe_bulk_writes);
+        }
+
+        if (data->flags & MMC_DATA_QUEUED) {
+                data->flags &= ~MMC_DATA_QUEUED;
+                atomic_dec(&core->cqe_writes);
+        }
+}
+
+static void mmc_cqe_account(struct mmc_host *host, struct mmc_request *mrq)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+        int dir = !!(mrq->data->flags & MMC_DATA_WRITE);
+        u64 ns;
+
+        ns = ktime_to_ns(ktime_sub(ktime_get(), core->cqe_issued[mrq->tag]));
+
+        core->cqe_done[dir] += 1;
+        core->cqe_ns[dir] += ns;
+        if (ns > core->cqe_max_ns[dir])
+                core->cqe_max_ns[dir] = ns;
+}
+
+static void mmc_cqe_recovery_notifier(struct mmc_request *mrq)
+{
+        struct mmc_core_host *core = mmc_core_host(mrq->host);
+
+        WRITE_ONCE(core->cqe_recovery_needed, true);
+}
+
+/**
+ *      mmc_cqe_start_req - queue a request on the command queue engine
+ *      @host: MMC host
+ *      @mrq: MMC request, a tagged transfer or a direct command
+ *
+ *      Returns zero once the request has been queued, its ->done() is
+ *      then called from mmc_cqe_request_done(). -EBUSY means the request
+ *      cannot be queued yet, e.g. a bulk write over the cap of
+ *      mmc_cqe_admit(): retry it once a queued request completes.
+ */
+int mmc_cqe_start_req(struct mmc_host *host, struct mmc_request *mrq)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+        int err;
+
+        WARN_ON(!host->claimed);
+
+        if (mrq->cmd && !(host->caps2 & MMC_CAP2_CQE_DCMD)) {
+                err = -EINVAL;
+                goto out_err;
+        }
+
+        if (READ_ONCE(core->cqe_recovery_needed)) {
+                err = mmc_cqe_recovery(host);
+                if (err)
+                        goto out_err;
+        }
+
+        err = mmc_cqe_admit(host, mrq);
+        if (err)
+                goto out_err;
+
+        mmc_clk_scale_account(host, mrq);
+
+        /*
+         * CQE cannot process re-tuning commands. Callers hold re-tuning
+         * while requests are queued, so this only re-tunes for the first
+         * one, and re-tuning turns CQE off.
+         */
+        err = mmc_retune(host);
+        if (err)
+                goto out_release;
+
+        mrq->host = host;
+        if (!mrq->recovery_notifier)
+                mrq->recovery_notifier = mmc_cqe_recovery_notifier;
+
+        mmc_mrq_pr_debug(host, mrq, true);
+
+        err = mmc_mrq_prep(host, mrq);
+        if (err)
+                goto out_release;
+
+        if (mrq->data)
+                core->cqe_issued[mrq->tag] = ktime_get();
+
+        atomic_inc(&core->cqe_in_flight);
+
+        err = host->cqe_ops->cqe_request(host, mrq);
+        if (err) {
+                atomic_dec(&core->cqe_in_flight);
+                goto out_release;
+        }
+
+        trace_mmc_request_start(host, mrq);
+
+        return 0;
+
+out_release:
+        mmc_cqe_release(host, mrq);
+out_err:
+        if (mrq->cmd)
+                pr_debug("%s: failed to start CQE direct CMD%u, error %d\n",
+                         mmc_hostname(host), mrq->cmd->opcode, err);
+        else
+                pr_debug("%s: failed to start CQE transfer for tag %d, error %d\n",
+                         mmc_hostname(host), mrq->tag, err);
+        return err;
+}
+EXPORT_SYMBOL(mmc_cqe_start_req);
+
+/**
+ *      mmc_cqe_plug - start a batch of CQE requests
+ *      @host: MMC host, claimed
+ *
+ *      Data requests queued with mmc_cqe_start_req() until mmc_cqe_commit()
+ *      are handed to the engine together, which saves a doorbell write per
+ *      request. A DCMD is issued at once and takes the batch with it. The
+ *      caller must commit before it waits for any of the batch.
+ */
+void mmc_cqe_plug(struct mmc_host *host)
+{
+        const struct mmc_cqe_ext_ops *ext = mmc_core_host(host)->cqe_ext_ops;
+
+        if (ext && ext->cqe_plug)
+                ext->cqe_plug(host);
+}
+EXPORT_SYMBOL(mmc_cqe_plug);
+
+/**
+ *      mmc_cqe_commit - issue the CQE requests batched since mmc_cqe_plug()
+ *      @host: MMC host, claimed
+ */
+void mmc_cqe_commit(struct mmc_host *host)
+{
+        const struct mmc_cqe_ext_ops *ext = mmc_core_host(host)->cqe_ext_ops;
+
+        if (ext && ext->cqe_commit)
+                ext->cqe_commit(host);
+}
+EXPORT_SYMBOL(mmc_cqe_commit);
+
+/**
+ *      mmc_cqe_set_poll - have CQE completions reaped by polling
+ *      @host: MMC host
+ *      @poll: true to turn the completion interrupt off, false to restore it
+ *
+ *      For callers that spin for their requests anyway and would rather
+ *      not take an interrupt per completion. Until polling is turned off
+ *      again, whoever waits for a request has to call mmc_cqe_poll(), and
+ *      mmc_cqe_wait_for_dcmd() falls back to sending the command the
+ *      usual way. Returns -EOPNOTSUPP if the engine cannot poll.
+ */
+int mmc_cqe_set_poll(struct mmc_host *host, bool poll)
+{
+        const struct mmc_cqe_ext_ops *ext = mmc_core_host(host)->cqe_ext_ops;
+
+        if (!ext || !ext->cqe_set_poll || !ext->cqe_poll)
+                return -EOPNOTSUPP;
+
+        ext->cqe_set_poll(host, poll);
+
+        return 0;
+}
+EXPORT_SYMBOL(mmc_cqe_set_poll);
+
+/**
+ *      mmc_cqe_poll - complete finished CQE requests from the caller
+ *      @host: MMC host
+ *
+ *      Calls ->done() of every request the engine has finished, without
+ *      waiting for its interrupt. Returns how many there were, or
+ *      -EOPNOTSUPP if the engine cannot poll.
+ */
+int mmc_cqe_poll(struct mmc_host *host)
+{
+        const struct mmc_cqe_ext_ops *ext = mmc_core_host(host)->cqe_ext_ops;
+
+        if (!ext || !ext->cqe_poll)
+                return -EOPNOTSUPP;
+
+        return ext->cqe_poll(host);
+}
+EXPORT_SYMBOL(mmc_cqe_poll);
+
+/**
+ *      mmc_cqe_pool_init - give each CQE tag a pre-mapped data buffer
+ *      @host: MMC host
+ *      @size: bytes per tag, 0 to drop the buffers
+ *
+ *      Requests attached to a buffer with mmc_cqe_pool_attach() are issued
+ *      without mapping a scatterlist: the buffers stay mapped while CQE is
+ *      enabled and each request only syncs the bytes it moves. The engine
+ *      frees them when CQE is disabled and sets them up again on the next
+ *      enable. Must be called with no CQE requests queued, -EBUSY
+ *      otherwise, and -EOPNOTSUPP if the engine has no pool.
+ */
+int mmc_cqe_pool_init(struct mmc_host *host, unsigned int size)
+{
+        const struct mmc_cqe_ext_ops *ext = mmc_core_host(host)->cqe_ext_ops;
+
+        if (!ext || !ext->cqe_pool_init)
+                return -EOPNOTSUPP;
+
+        return ext->cqe_pool_init(host, size);
+}
+EXPORT_SYMBOL(mmc_cqe_pool_init);
+
+/**
+ *      mmc_cqe_pool_attach - issue a transfer from the buffer of a tag
+ *      @host: MMC host
+ *      @data: data of the request about to be started with tag @tag
+ *      @tag: the request's tag, see mmc_cqe_get_tag()
+ *
+ *      Points @data at the pool buffer of @tag. Returns that buffer, to
+ *      fill before a write or to read after a read completes, or NULL if
+ *      there is no pool or the transfer does not fit in it.
+ */
+void *mmc_cqe_pool_attach(struct mmc_host *host, struct mmc_data *data,
+                          int tag)
+{
+        const struct mmc_cqe_ext_ops *ext = mmc_core_host(host)->cqe_ext_ops;
+
+        if (!ext || !ext->cqe_pool_attach)
+                return NULL;
+
+        return ext->cqe_pool_attach(host, data, tag);
+}
+EXPORT_SYMBOL(mmc_cqe_pool_attach);
+
+/**
+ *      mmc_cqe_request_done - CQE has finished processing an MMC request
+ *      @host: MMC host which completed request
+ *      @mrq: MMC request which completed
+ *
+ *      CQE drivers should call this function when they have completed
+ *      their processing of a request.
+ */
+void mmc_cqe_request_done(struct mmc_host *host, struct mmc_request *mrq)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        /* Flag re-tuning needed on CRC errors */
+        if ((mrq->cmd && mrq->cmd->error == -EILSEQ) ||
+            (mrq->data && mrq->data->error == -EILSEQ))
+                mmc_retune_needed(host);
+
+        trace_mmc_request_done(host, mrq);
+
+        if (mrq->cmd)
+                pr_debug("%s: CQE req done (direct CMD%u): %d\n",
+                         mmc_hostname(host), mrq->cmd->opcode,
+                         mrq->cmd->error);
+        else
+                pr_debug("%s: CQE transfer done tag %d\n",
+                         mmc_hostname(host), mrq->tag);
+
+        if (mrq->data)
+                pr_debug("%s:     %d bytes transferred: %d\n",
+                         mmc_hostname(host),
+                         mrq->data->bytes_xfered, mrq->data->error);
+
+        if (mrq->data) {
+                mmc_cqe_account(host, mrq);
+                mmc_cqe_release(host, mrq);
+        }
+
+        atomic_dec(&core->cqe_in_flight);
+
+        mrq->done(mrq);
+}
+EXPORT_SYMBOL(mmc_cqe_request_done);
+
+/**
+ *      mmc_cqe_post_req - CQE post process of a completed MMC request
+ *      @host: MMC host
+ *      @mrq: MMC request to be processed
+ */
+void mmc_cqe_post_req(struct mmc_host *host, struct mmc_request *mrq)
+{
+        if (host->cqe_ops->cqe_post_req)
+                host->cqe_ops->cqe_post_req(host, mrq);
+}
+EXPORT_SYMBOL(mmc_cqe_post_req);
+
+/**
+ *      mmc_cqe_set_stream - place a CQE transfer in a context and tag it
+ *      @card: MMC card
+ *      @mrq: data request, before mmc_cqe_start_req()
+ *      @context: ID from mmc_context_open(), or 0 for none
+ *      @hot: metadata or hot data, set the data tag
+ *
+ *      A context closed in the meantime, or one not opened for the
+ *      transfer's direction, is dropped. The card only honours the data
+ *      tag on writes that cover whole tag units, so it is dropped from
+ *      any other transfer.
+ */
+void mmc_cqe_set_stream(struct mmc_card *card, struct mmc_request *mrq,
+                        unsigned int context, bool hot)
+{
+        struct mmc_core_host *core = mmc_core_host(card->host);
+        struct mmc_data *data = mrq->data;
+        unsigned int unit = card->ext_csd.data_tag_unit_size;
+        unsigned int dir;
+        u64 start, len;
+
+        data->flags &= ~(MMC_DATA_DAT_TAG | MMC_DATA_CONTEXT_MASK);
+
+        dir = data->flags & MMC_DATA_WRITE ? MMC_CONTEXT_WRITE :
+                                             MMC_CONTEXT_READ;
+        if (context && context <= core->context_max &&
+            core->context_conf[context - 1] & dir) {
+                data->flags |= MMC_DATA_CONTEXT(context);
+                core->context_reqs++;
+        }
+
+        if (!hot || !unit || !(data->flags & MMC_DATA_WRITE))
+                return;
+
+        start = data->blk_addr;
+        if (mmc_card_blockaddr(card))
+                start <<= 9;
+        len = (u64)data->blksz * data->blocks;
+
+        /* Tag units are a power of two sectors */
+        if ((start | len) & (unit - 1)) {
+                core->data_tag_unaligned++;
+                return;
+        }
+
+        data->flags |= MMC_DATA_DAT_TAG;
+        core->data_tag_reqs++;
+}
+EXPORT_SYMBOL(mmc_cqe_set_stream);
+
+/**
+ *      mmc_cqe_timed_out - tell CQE a request has timed out
+ *      @host: MMC host
+ *      @mrq: MMC request that timed out
+ *
+ *      Returns true if @mrq was still queued. It has then been failed back
+ *      or the engine halted for recovery, which the next
+ *      mmc_cqe_start_req() or mmc_cqe_wait_for_idle() runs.
+ */
+bool mmc_cqe_timed_out(struct mmc_host *host, struct mmc_request *mrq)
+{
+        bool recovery_needed = false;
+        bool timed_out;
+
+        timed_out = host->cqe_ops->cqe_timeout(host, mrq, &recovery_needed);
+        if (recovery_needed)
+                WRITE_ONCE(mmc_core_host(host)->cqe_recovery_needed, true);
+
+        return timed_out;
+}
+EXPORT_SYMBOL(mmc_cqe_timed_out);
+
+/**
+ *      mmc_cqe_wait_for_idle - wait for all queued CQE requests to finish
+ *      @host: MMC host
+ *
+ *      An engine halted by an error is recovered on the way, which fails
+ *      back whatever was still queued.
+ */
+int mmc_cqe_wait_for_idle(struct mmc_host *host)
+{
+        int err;
+
+        while ((err = host->cqe_ops->cqe_wait_for_idle(host)) == -EBUSY) {
+                err = mmc_cqe_recovery(host);
+                if (err)
+                        break;
+        }
+
+        return err;
+}
+EXPORT_SYMBOL(mmc_cqe_wait_for_idle);
+
+static void mmc_cqe_dcmd_done(struct mmc_request *mrq)
+{
+        complete(&mrq->completion);
+}
+
+/* Grace on top of the command's busy timeout, or all of it when unset */
+#define MMC_CQE_DCMD_SLACK_MS           1000
+#define MMC_CQE_DCMD_TIMEOUT_MS         (60 * 1000)
+/* How often a waiting DCMD looks for a recovery to run */
+#define MMC_CQE_DCMD_RECHECK_MS         20
+
+static int mmc_cqe_issue_dcmd(struct mmc_host *host, struct mmc_command *cmd)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+        struct mmc_request mrq = {};
+        unsigned long timeout, end;
+        int err;
+
+        timeout = msecs_to_jiffies(cmd->busy_timeout ?
+                                   cmd->busy_timeout + MMC_CQE_DCMD_SLACK_MS :
+                                   MMC_CQE_DCMD_TIMEOUT_MS);
+
+        memset(cmd->resp, 0, sizeof(cmd->resp));
+        cmd->error = 0;
+        mrq.cmd = cmd;
+        mrq.done = mmc_cqe_dcmd_done;
+        init_completion(&mrq.completion);
+
+        err = mmc_cqe_start_req(host, &mrq);
+        if (err)
+                return err;
+
+        core->cqe_dcmds++;
+
+        /*
+         * A task failing ahead of the DCMD halts the queue, and we hold
+         * the host, so nobody but us can run the recovery.
+         */
+        end = jiffies + timeout;
+        while (!wait_for_completion_timeout(&mrq.completion,
+                        msecs_to_jiffies(MMC_CQE_DCMD_RECHECK_MS))) {
+                if (READ_ONCE(core->cqe_recovery_needed)) {
+                        /* Recovery fails back the DCMD if it has to */
+                        mmc_cqe_recovery(host);
+                } else if (time_after(jiffies, end)) {
+                        mmc_cqe_timed_out(host, &mrq);
+                        end = jiffies + timeout;
+                }
+        }
+
+        mmc_cqe_post_req(host, &mrq);
+
+        return cmd->error;
+}
+
+/**
+ *      mmc_cqe_wait_for_dcmd - send a command through the CQE DCMD slot
+ *      @host: MMC host, claimed
+ *      @cmd: command without data
+ *      @retries: times to re-send @cmd if it fails
+ *
+ *      While CQE is on, any other command halts the engine and drains the
+ *      queue. A direct command is queued behind the tasks already there
+ *      instead, the engine handles R1b busy, and the queue keeps running.
+ *      Returns -EOPNOTSUPP when CQE is off or has no DCMD slot, or the
+ *      host reaps completions by polling: the caller then sends @cmd the
+ *      usual way. A DCMD that fails or times out is recovered from here,
+ *      as nobody else may be waiting on the queue.
+ */
+int mmc_cqe_wait_for_dcmd(struct mmc_host *host, struct mmc_command *cmd,
+                          unsigned int retries)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+        int err;
+
+        /* Re-tuning sends its own commands, which land here again */
+        if (!host->cqe_on || !(host->caps2 & MMC_CAP2_CQE_DCMD) ||
+            host->doing_retune)
+                return -EOPNOTSUPP;
+
+        /*
+         * Re-tune before taking the lock, not from mmc_cqe_start_req():
+         * the HS400 round trip polls the card status through here.
+         */
+        err = mmc_retune(host);
+        if (err)
+                return err;
+
+        /* The engine does not retry, do it here as mmc_wait_for_cmd() does */
+        cmd->retries = 0;
+
+        mutex_lock(&core->cqe_dcmd_lock);
+
+        do {
+                /* Re-tuning and a full recovery turn CQE off */
+                if (!host->cqe_on) {
+                        err = -EOPNOTSUPP;
+                        break;
+                }
+
+                err = mmc_cqe_issue_dcmd(host, cmd);
+        } while (err && cmd->error && cmd->error != -ENOMEDIUM && retries--);
+
+        mutex_unlock(&core->cqe_dcmd_lock);
+
+        return err;
+}
+EXPORT_SYMBOL(mmc_cqe_wait_for_dcmd);
+
+/* Arbitrary 1 second timeout */
+#define MMC_CQE_RECOVERY_TIMEOUT        1000
+
+/**
+ *      mmc_cqe_set_ext_ops - register the CQE operations of core/cqe.h
+ *      @host: MMC host
+ *      @ops: operations, or NULL to drop them
+ *
+ *      Called by the CQE driver alongside setting host->cqe_ops.
+ */
+void mmc_cqe_set_ext_ops(struct mmc_host *host,
+                         const struct mmc_cqe_ext_ops *ops)
+{
+        mmc_core_host(host)->cqe_ext_ops = ops;
+}
+EXPORT_SYMBOL(mmc_cqe_set_ext_ops);
+
+/*
+ * Recover just the task the engine found at fault, leaving the rest of the
+ * queue running. The engine is halted and CQE off. Any error means the
+ * full recovery is needed.
+ */
+static int mmc_cqe_recover_task(struct mmc_host *host)
+{
+        const struct mmc_cqe_ext_ops *ext = mmc_core_host(host)->cqe_ext_ops;
+        struct mmc_command cmd = {};
+        unsigned int flags = 0;
+        int tag, err;
+
+        if (!ext || !ext->cqe_recovery_task)
+                return -EOPNOTSUPP;
+
+        tag = ext->cqe_recovery_task(host, &flags);
+        if (tag < 0)
+                return tag;
+
+        /*
+         * A data error leaves the card in the task's transfer, stop it. A
+         * task that failed while being queued may or may not be on the
+         * card, discard it there.
+         */
+        if (!(flags & MMC_CQE_TASK_IDLE)) {
+                if (flags & MMC_CQE_TASK_QUEUED) {
+                        cmd.opcode = MMC_CMDQ_TASK_MGMT;
+                        cmd.arg = (tag << 16) | 2; /* Discard task */
+                } else {
+                        cmd.opcode = MMC_STOP_TRANSMISSION;
+                }
+                cmd.flags = (MMC_RSP_R1B & ~MMC_RSP_CRC) | MMC_CMD_AC;
+                cmd.busy_timeout = MMC_CQE_RECOVERY_TIMEOUT;
+                err = mmc_wait_for_cmd(host, &cmd, 0);
+                if (err)
+                        return err;
+        }
+
+        return ext->cqe_recovery_resume(host, tag);
+}
+
+/**
+ *      mmc_cqe_recovery - recover from CQE errors
+ *      @host: MMC host to recover
+ *
+ *      Recovery consists of stopping CQE, stopping eMMC, discarding the
+ *      queue in eMMC, and discarding the queue in CQE. CQE must call
+ *      mmc_cqe_request_done() on all requests. An error is returned if
+ *      the eMMC fails to discard its queue. A CQE that can clear just the
+ *      failed task gets to, see mmc_cqe_recover_task(), and keeps the rest
+ *      of the queue running.
+ */
+int mmc_cqe_recovery(struct mmc_host *host)
+{
+        struct mmc_command cmd = {};
+        int err;
+
+        WRITE_ONCE(mmc_core_host(host)->cqe_recovery_needed, false);
+
+        mmc_retune_hold_now(host);
+
+        /*
+         * Recovery is expected seldom, if at all, but it reduces
+         * performance, so make sure it is not completely silent.
+         */
+        pr_warn("%s: running CQE recovery\n", mmc_hostname(host));
+
+        host->cqe_ops->cqe_recovery_start(host);
+
+        if (!mmc_cqe_recover_task(host)) {
+                mmc_retune_release(host);
+                return 0;
+        }
+
+        cmd.opcode = MMC_STOP_TRANSMISSION;
+        cmd.flags = (MMC_RSP_R1B & ~MMC_RSP_CRC) | MMC_CMD_AC;
+        cmd.busy_timeout = MMC_CQE_RECOVERY_TIMEOUT;
+        mmc_wait_for_cmd(host, &cmd, 0);
+
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.opcode = MMC_CMDQ_TASK_MGMT;
+        cmd.arg = 1; /* Discard entire queue */
+        cmd.flags = (MMC_RSP_R1B & ~MMC_RSP_CRC) | MMC_CMD_AC;
+        cmd.busy_timeout = MMC_CQE_RECOVERY_TIMEOUT;
+        err = mmc_wait_for_cmd(host, &cmd, 0);
+
+        host->cqe_ops->cqe_recovery_finish(host);
+
+        mmc_retune_release(host);
+
+        return err;
+}
+EXPORT_SYMBOL(mmc_cqe_recovery);
+
 /*
  * Apply power to the MMC stack.  This is a two-stage process.
  * First, we enable power to the card without the clock running.
@@ -1043,6 +1763,32 @@ int __mmc_claim_host(struct mmc_host *host, struct mmc_ctx *ctx,
 }
 EXPORT_SYMBOL(__mmc_claim_host);
 
+/**
+ *      mmc_try_claim_host - try exclusively to claim a host
+ *      @host: mmc host to claim
+ *
+ *      Returns %1 if the host is claimed, %0 otherwise.
+ */
+int mmc_try_claim_host(struct mmc_host *host)
+{
+        int claimed_host = 0;
+        unsigned long flags;
+
+        spin_lock_irqsave(&host->lock, flags);
+        if (!host->claimed) {
+                host->claimed = 1;
+                mmc_ctx_set_claimer(host, NULL, current);
+                host->claim_cnt += 1;
+                claimed_host = 1;
+        }
+        spin_unlock_irqrestore(&host->lock, flags);
+
+        if (claimed_host)
+                pm_runtime_get_sync(mmc_dev(host));
+
+        return claimed_host;
+}
+
 /**
  *      mmc_release_host - release a host
  *      @host: mmc host to release
@@ -1083,6 +1829,10 @@ void mmc_set_clock(struct mmc_host *host, unsigned int hz)
         if (hz > host->f_max)
                 hz = host->f_max;
 
+        /* Whatever the card was just set up for is the clock to scale to */
+        mmc_core_host(host)->clk_scale_max = hz;
+        mmc_core_host(host)->clk_scaled_down = false;
+
         host->ios.clock = hz;
         mmc_set_ios(host);
 }
@@ -1368,6 +2118,7 @@ void mmc_set_driver_type(struct mmc_host *host, unsigned int drv_type)
 int mmc_execute_tuning(struct mmc_card *card)
 {                       
         struct mmc_host *host = card->host;
+        struct mmc_core_host *core = mmc_core_host(host);
         u32 opcode;
         int err;
         
@@ -1383,12 +2134,18 @@ int mmc_execute_tuning(struct mmc_card *card)
                 opcode = MMC_SEND_TUNING_BLOCK;
 
         err = host->ops->execute_tuning(host, opcode);
+        core->tuning_count++;
     
-        if (err)
+        if (err) {
+                core->tuning_errors++;
                 pr_err("%s: tuning execution failed: %d\n",
                         mmc_hostname(host), err);
-        else
+        } else {
+                core->tuned = true;
+                core->tuned_timing = host->ios.timing;
+                core->tuned_clock = host->ios.clock;
                 mmc_retune_enable(host);
+        }
 
         return err;
 }
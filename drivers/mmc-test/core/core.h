@@ -42,6 +42,7 @@ struct device_node *mmc_of_find_child_device(struct mmc_host *host,
 
 void mmc_init_erase(struct mmc_card *card);
 
+void mmc_set_ios(struct mmc_host *host);
 void mmc_set_chip_select(struct mmc_host *host, int mode);
 void mmc_set_clock(struct mmc_host *host, unsigned int hz);
 void mmc_set_bus_mode(struct mmc_host *host, unsigned int mode);
@@ -125,6 +126,7 @@ int mmc_set_blockcount(struct mmc_card *card, unsigned int blockcount,
 
 int __mmc_claim_host(struct mmc_host *host, struct mmc_ctx *ctx,
 		     atomic_t *abort);
+int mmc_try_claim_host(struct mmc_host *host);
 void mmc_release_host(struct mmc_host *host);
 void mmc_get_card(struct mmc_card *card, struct mmc_ctx *ctx);
 void mmc_put_card(struct mmc_card *card, struct mmc_ctx *ctx);
@@ -140,9 +142,44 @@ static inline void mmc_claim_host(struct mmc_host *host)
 	__mmc_claim_host(host, NULL, NULL);
 }
 
+int mmc_cqe_get_tag(struct mmc_host *host);
+void mmc_cqe_put_tag(struct mmc_host *host, int tag);
 int mmc_cqe_start_req(struct mmc_host *host, struct mmc_request *mrq);
+void mmc_cqe_plug(struct mmc_host *host);
+void mmc_cqe_commit(struct mmc_host *host);
+int mmc_cqe_set_poll(struct mmc_host *host, bool poll);
+int mmc_cqe_poll(struct mmc_host *host);
+int mmc_cqe_pool_init(struct mmc_host *host, unsigned int size);
+void *mmc_cqe_pool_attach(struct mmc_host *host, struct mmc_data *data,
+			  int tag);
 void mmc_cqe_post_req(struct mmc_host *host, struct mmc_request *mrq);
+bool mmc_cqe_timed_out(struct mmc_host *host, struct mmc_request *mrq);
+int mmc_cqe_wait_for_idle(struct mmc_host *host);
 int mmc_cqe_recovery(struct mmc_host *host);
+int mmc_cqe_wait_for_dcmd(struct mmc_host *host, struct mmc_command *cmd,
+			  unsigned int retries);
+
+/* Modes of an eMMC context, see mmc_context_open() */
+#define MMC_CONTEXT_WRITE	0x1
+#define MMC_CONTEXT_READ	0x2
+#define MMC_CONTEXT_RW		(MMC_CONTEXT_WRITE | MMC_CONTEXT_READ)
+
+/*
+ * struct mmc_data has no room for the context ID of a transfer, so it
+ * rides in flag bits above the MMC_DATA_* ones. CQE drivers copy it into
+ * the task descriptor.
+ */
+#define MMC_DATA_CONTEXT_SHIFT	16
+#define MMC_DATA_CONTEXT_MASK	(0xF << MMC_DATA_CONTEXT_SHIFT)
+#define MMC_DATA_CONTEXT(id)	(((id) & 0xF) << MMC_DATA_CONTEXT_SHIFT)
+
+void mmc_cqe_set_stream(struct mmc_card *card, struct mmc_request *mrq,
+			unsigned int context, bool hot);
+
+/* Core-private: a write counted against the bulk cap, see mmc_cqe_admit() */
+#define MMC_DATA_BULK		BIT(20)
+/* Core-private: a write counted in cqe_writes, see mmc_cqe_admit() */
+#define MMC_DATA_QUEUED		BIT(21)
 
 /**
  *	mmc_pre_req - Prepare for a new request
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ *  linux/drivers/mmc/core/cqe.h
+ *
+ * Command queue engine operations that struct mmc_cqe_ops in
+ * linux/mmc/host.h has no room for. CQE host drivers register them with
+ * mmc_cqe_set_ext_ops() and the core calls them from the mmc_cqe_*()
+ * helpers.
+ */
+#ifndef _MMC_CORE_CQE_H
+#define _MMC_CORE_CQE_H
+
+#include <linux/bitops.h>
+
+struct mmc_data;
+struct mmc_host;
+
+/* What the card still holds of a failed task, see ->cqe_recovery_task() */
+#define MMC_CQE_TASK_QUEUED	BIT(0)	/* Failed while queued: discard it */
+#define MMC_CQE_TASK_IDLE	BIT(1)	/* Nothing left to stop, e.g. a DCMD */
+
+struct mmc_cqe_ext_ops {
+	/* Hold back the doorbell for a batch of tasks, see mmc_cqe_plug() */
+	void	(*cqe_plug)(struct mmc_host *host);
+	void	(*cqe_commit)(struct mmc_host *host);
+	/* Reap completions without the interrupt, see mmc_cqe_poll() */
+	void	(*cqe_set_poll)(struct mmc_host *host, bool poll);
+	int	(*cqe_poll)(struct mmc_host *host);
+	/* Pre-mapped data buffers, see mmc_cqe_pool_init() */
+	int	(*cqe_pool_init)(struct mmc_host *host, unsigned int size);
+	void	*(*cqe_pool_attach)(struct mmc_host *host,
+				    struct mmc_data *data, int tag);
+	/*
+	 * Targeted recovery, once ->cqe_recovery_start() has halted the
+	 * engine. ->cqe_recovery_task() returns the tag of the one task at
+	 * fault, or a negative error when the whole queue has to go. After
+	 * the core has stopped the card working on it,
+	 * ->cqe_recovery_resume() clears just that task, fails it back and
+	 * resumes the rest of the queue.
+	 */
+	int	(*cqe_recovery_task)(struct mmc_host *host,
+				     unsigned int *flags);
+	int	(*cqe_recovery_resume)(struct mmc_host *host, int tag);
+};
+
+void mmc_cqe_set_ext_ops(struct mmc_host *host,
+			 const struct mmc_cqe_ext_ops *ops);
+
+#endif
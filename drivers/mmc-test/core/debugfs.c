@@ -15,6 +15,7 @@
 #include <linux/slab.h>
 #include <linux/stat.h>
 #include <linux/fault-inject.h>
+#include <linux/math64.h>
 
 #include <linux/mmc/card.h>
 #include <linux/mmc/host.h>
@@ -204,6 +205,81 @@ static int mmc_ios_show(struct seq_file *s, void *data)
 }
 DEFINE_SHOW_ATTRIBUTE(mmc_ios);
 
+static int mmc_tuning_show(struct seq_file *s, void *data)
+{
+	struct mmc_host	*host = s->private;
+	struct mmc_core_host *core = mmc_core_host(host);
+
+	if (core->tuned) {
+		seq_printf(s, "timing:\t\t%u\n", core->tuned_timing);
+		seq_printf(s, "clock:\t\t%u Hz\n", core->tuned_clock);
+	} else {
+		seq_puts(s, "timing:\t\tnone\n");
+	}
+	seq_printf(s, "tunings:\t%u\n", core->tuning_count);
+	seq_printf(s, "errors:\t\t%u\n", core->tuning_errors);
+	seq_printf(s, "verified:\t%u\n", core->retune_verified);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mmc_tuning);
+
+static int mmc_clk_scale_show(struct seq_file *s, void *data)
+{
+	struct mmc_host	*host = s->private;
+	struct mmc_core_host *core = mmc_core_host(host);
+
+	seq_printf(s, "enabled:\t%u\n", core->clk_scale_enabled);
+	seq_printf(s, "scaled down:\t%u\n", core->clk_scaled_down);
+	seq_printf(s, "max clock:\t%u Hz\n", core->clk_scale_max);
+	seq_printf(s, "ups:\t\t%u\n", core->clk_scale_ups);
+	seq_printf(s, "downs:\t\t%u\n", core->clk_scale_downs);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mmc_clk_scale);
+
+static int mmc_contexts_show(struct seq_file *s, void *data)
+{
+	struct mmc_host	*host = s->private;
+	struct mmc_core_host *core = mmc_core_host(host);
+	static const char * const mode[] = { "closed", "w", "r", "rw" };
+	unsigned int id;
+
+	seq_printf(s, "max:\t\t%u\n", core->context_max);
+	for (id = 1; id <= core->context_max; id++)
+		if (core->context_conf[id - 1])
+			seq_printf(s, "%u:\t\t%s\n", id,
+				   mode[core->context_conf[id - 1] & 3]);
+	seq_printf(s, "in context:\t%llu\n", core->context_reqs);
+	seq_printf(s, "tagged:\t\t%llu\n", core->data_tag_reqs);
+	seq_printf(s, "unaligned:\t%u\n", core->data_tag_unaligned);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mmc_contexts);
+
+static int mmc_clk_scale_opt_get(void *data, u64 *val)
+{
+	struct mmc_host *host = data;
+
+	*val = mmc_core_host(host)->clk_scale_enabled;
+
+	return 0;
+}
+
+static int mmc_clk_scale_opt_set(void *data, u64 val)
+{
+	struct mmc_host *host = data;
+
+	mmc_clk_scale_enable(host, !!val);
+
+	return 0;
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(mmc_clk_scale_enable_fops, mmc_clk_scale_opt_get,
+	mmc_clk_scale_opt_set, "%llu\n");
+
 static int mmc_clock_opt_get(void *data, u64 *val)
 {
 	struct mmc_host *host = data;
@@ -235,6 +311,73 @@ static int mmc_clock_opt_set(void *data, u64 val)
 DEFINE_SIMPLE_ATTRIBUTE(mmc_clock_fops, mmc_clock_opt_get, mmc_clock_opt_set,
 	"%llu\n");
 
+static int mmc_cqe_sched_show(struct seq_file *s, void *data)
+{
+	struct mmc_host	*host = s->private;
+	struct mmc_core_host *core = mmc_core_host(host);
+	static const char * const dir[] = { "read", "write" };
+	int i;
+
+	seq_printf(s, "writes queued:\t%d\n",
+		   atomic_read(&core->cqe_writes));
+	seq_printf(s, "bulk queued:\t%d\n",
+		   atomic_read(&core->cqe_bulk_writes));
+	seq_printf(s, "throttled:\t%u\n", core->cqe_throttled);
+	seq_printf(s, "dcmds:\t\t%u\n", core->cqe_dcmds);
+	for (i = 0; i < ARRAY_SIZE(dir); i++) {
+		seq_printf(s, "%ss:\t\t%llu\n", dir[i], core->cqe_done[i]);
+		seq_printf(s, "%s avg:\t%llu ns\n", dir[i], core->cqe_done[i] ?
+			   div64_u64(core->cqe_ns[i], core->cqe_done[i]) : 0);
+		seq_printf(s, "%s max:\t%llu ns\n", dir[i],
+			   core->cqe_max_ns[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mmc_cqe_sched);
+
+static bool mmc_cqe_sched_debugfs(struct mmc_host *host, struct dentry *root)
+{
+	struct mmc_core_host *core = mmc_core_host(host);
+
+	root = debugfs_create_dir("cqe_sched", root);
+	if (IS_ERR_OR_NULL(root))
+		return false;
+
+	return debugfs_create_bool("enable", S_IRUSR | S_IWUSR, root,
+				   &core->cqe_sched) &&
+	       debugfs_create_file("state", S_IRUSR, root, host,
+				   &mmc_cqe_sched_fops) &&
+	       debugfs_create_u32("bulk_bytes", S_IRUSR | S_IWUSR, root,
+				  &core->cqe_bulk_bytes) &&
+	       debugfs_create_u32("bulk_max", S_IRUSR | S_IWUSR, root,
+				  &core->cqe_bulk_max);
+}
+
+static bool mmc_clk_scale_debugfs(struct mmc_host *host, struct dentry *root)
+{
+	struct mmc_core_host *core = mmc_core_host(host);
+
+	root = debugfs_create_dir("clk_scale", root);
+	if (IS_ERR_OR_NULL(root))
+		return false;
+
+	return debugfs_create_file("enable", S_IRUSR | S_IWUSR, root, host,
+				   &mmc_clk_scale_enable_fops) &&
+	       debugfs_create_file("state", S_IRUSR, root, host,
+				   &mmc_clk_scale_fops) &&
+	       debugfs_create_u32("low_hz", S_IRUSR | S_IWUSR, root,
+				  &core->clk_scale_low) &&
+	       debugfs_create_u32("period_ms", S_IRUSR | S_IWUSR, root,
+				  &core->clk_scale_period_ms) &&
+	       debugfs_create_u32("down_reqs", S_IRUSR | S_IWUSR, root,
+				  &core->clk_scale_down_reqs) &&
+	       debugfs_create_u32("up_ms", S_IRUSR | S_IWUSR, root,
+				  &core->clk_scale_up_ms) &&
+	       debugfs_create_u32("up_bytes", S_IRUSR | S_IWUSR, root,
+				  &core->clk_scale_up_bytes);
+}
+
 void mmc_add_host_debugfs(struct mmc_host *host)
 {
 	struct dentry *root;
@@ -263,6 +406,20 @@ void mmc_add_host_debugfs(struct mmc_host *host)
 			&mmc_clock_fops))
 		goto err_node;
 
+	if (!debugfs_create_file("tuning", S_IRUSR, root, host,
+			&mmc_tuning_fops))
+		goto err_node;
+
+	if (!mmc_clk_scale_debugfs(host, root))
+		goto err_node;
+
+	if (!debugfs_create_file("contexts", S_IRUSR, root, host,
+			&mmc_contexts_fops))
+		goto err_node;
+
+	if (!mmc_cqe_sched_debugfs(host, root))
+		goto err_node;
+
 #ifdef CONFIG_FAIL_MMC_REQUEST
 	if (fail_request)
 		setup_fault_attr(&fail_default_attr, fail_request);
@@ -20,6 +20,8 @@
 #include <linux/pagemap.h>
 #include <linux/export.h>
 #include <linux/leds.h>
+#include <linux/pm_runtime.h>
+#include <linux/sizes.h>
 #include <linux/slab.h>
 
 #include <linux/mmc/host.h>
@@ -30,17 +32,31 @@
 #include "host.h"
 #include "slot-gpio.h"
 #include "pwrseq.h"
+#include "mmc_ops.h"
 #include "sdio_ops.h"
 
 #define cls_dev_to_mmc_host(d)  container_of(d, struct mmc_host, class_dev)
 
+#define MMC_RETUNE_IDLE_RETRY   msecs_to_jiffies(10)
+
+/* Clock scaling defaults, all adjustable in debugfs */
+#define MMC_CLK_SCALE_LOW               25000000
+#define MMC_CLK_SCALE_PERIOD_MS         100
+#define MMC_CLK_SCALE_DOWN_REQS         4
+#define MMC_CLK_SCALE_UP_MS             5
+#define MMC_CLK_SCALE_UP_BYTES          SZ_256K
+
+/* CQE scheduling defaults, all adjustable in debugfs */
+#define MMC_CQE_BULK_BYTES              SZ_64K
+#define MMC_CQE_BULK_MAX                8
+
 static DEFINE_IDA(mmc_host_ida);
 
 static void mmc_host_classdev_release(struct device *dev)
 {
         struct mmc_host *host = cls_dev_to_mmc_host(dev);
         ida_simple_remove(&mmc_host_ida, host->index);
-        kfree(host);
+        kfree(mmc_core_host(host));
 }
 
 static struct class mmc_host_class = {
@@ -74,6 +90,9 @@ void mmc_retune_disable(struct mmc_host *host)
         del_timer_sync(&host->retune_timer);
         host->retune_now = 0;
         host->need_retune = 0;
+        mmc_core_host(host)->retune_periodic = false;
+        mmc_core_host(host)->tuned = false;
+        cancel_delayed_work(&mmc_core_host(host)->retune_work);
 }
 
 void mmc_retune_hold(struct mmc_host *host)
@@ -95,8 +114,59 @@ EXPORT_SYMBOL(mmc_retune_release);
 static void mmc_retune_timer(struct timer_list *t)
 {
         struct mmc_host *host = from_timer(host, t, retune_timer);
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        /*
+         * Anything calling mmc_retune_needed() gets a full tuning, while
+         * a periodic re-tune may first try the cached sample point, so
+         * keep the two apart. The periodic one is done by
+         * mmc_retune_work() once the bus is idle, the request path only
+         * takes it over after another period has gone by.
+         */
+        if (host->can_retune) {
+                core->retune_periodic = true;
+                core->retune_deadline = jiffies + host->retune_period * HZ;
+                queue_delayed_work(system_freezable_wq, &core->retune_work, 0);
+        }
+}
+
+static int __mmc_retune(struct mmc_host *host);
+
+static void mmc_retune_work(struct work_struct *work)
+{
+        struct mmc_core_host *core = container_of(work, struct mmc_core_host,
+                                                  retune_work.work);
+        struct mmc_host *host = &core->host;
+
+        /* Scaling back up proves the cached tuning at the full clock */
+        if (!host->can_retune || !core->retune_periodic ||
+            core->clk_scaled_down)
+                return;
+
+        /* A runtime suspended host is re-tuned in full when it resumes */
+        if (pm_runtime_suspended(mmc_dev(host)))
+                return;
+
+        if (!mmc_try_claim_host(host)) {
+                if (host->can_retune &&
+                    time_before(jiffies, core->retune_deadline))
+                        queue_delayed_work(system_freezable_wq,
+                                           &core->retune_work,
+                                           MMC_RETUNE_IDLE_RETRY);
+                return;
+        }
+
+        /*
+         * mmc_retune_disable() is called with the host claimed, so it
+         * cannot wait for this work. Check again now that the claim is
+         * ours: it may have run since the checks above.
+         */
+        if (host->can_retune && core->retune_periodic && !host->hold_retune &&
+            !host->doing_retune && host->card &&
+            !pm_runtime_suspended(&host->card->dev))
+                __mmc_retune(host);
 
-        mmc_retune_needed(host);
+        mmc_release_host(host);
 }
 
 /**
@@ -113,6 +183,11 @@ void mmc_remove_host(struct mmc_host *host)
                 mmc_unregister_pm_notifier(host);
         mmc_stop_host(host);
 
+        cancel_delayed_work_sync(&mmc_core_host(host)->retune_work);
+
+        mmc_core_host(host)->clk_scale_enabled = false;
+        cancel_delayed_work_sync(&mmc_core_host(host)->clk_scale_work);
+
 #ifdef CONFIG_DEBUG_FS
         mmc_remove_host_debugfs(host);
 #endif
@@ -135,12 +210,15 @@ struct mmc_host *mmc_alloc_host(int extra, struct device *dev)
 {
         int err;
         int alias_id;
+        struct mmc_core_host *core;
         struct mmc_host *host;
 
-        host = kzalloc(sizeof(struct mmc_host) + extra, GFP_KERNEL);
-        if (!host)
+        core = kzalloc(sizeof(struct mmc_core_host) + extra, GFP_KERNEL);
+        if (!core)
                 return NULL;
 
+        host = &core->host;
+
         /* scanning will be enabled when we're ready */
         host->rescan_disable = 1;
         host->parent = dev;
@@ -154,7 +232,7 @@ struct mmc_host *mmc_alloc_host(int extra, struct device *dev)
                                         mmc_first_nonreserved_index(),
                                         0, GFP_KERNEL);
        if (err < 0) {
-                kfree(host);
+                kfree(core);
                 return NULL;
         }
 
@@ -170,7 +248,7 @@ struct mmc_host *mmc_alloc_host(int extra, struct device *dev)
         if (mmc_gpio_alloc(host)) {
                 put_device(&host->class_dev);
                 ida_simple_remove(&mmc_host_ida, host->index);
-                kfree(host);
+                kfree(core);
                 return NULL;
         }
 
@@ -179,6 +257,19 @@ struct mmc_host *mmc_alloc_host(int extra, struct device *dev)
         INIT_DELAYED_WORK(&host->detect, mmc_rescan);
         INIT_DELAYED_WORK(&host->sdio_irq_work, sdio_irq_work);
         timer_setup(&host->retune_timer, mmc_retune_timer, 0);
+        INIT_DELAYED_WORK(&core->retune_work, mmc_retune_work);
+        INIT_DELAYED_WORK(&core->clk_scale_work, mmc_clk_scale_work);
+
+        core->clk_scale_low = MMC_CLK_SCALE_LOW;
+        core->clk_scale_period_ms = MMC_CLK_SCALE_PERIOD_MS;
+        core->clk_scale_down_reqs = MMC_CLK_SCALE_DOWN_REQS;
+        core->clk_scale_up_ms = MMC_CLK_SCALE_UP_MS;
+        core->clk_scale_up_bytes = MMC_CLK_SCALE_UP_BYTES;
+
+        mutex_init(&core->cqe_dcmd_lock);
+        core->cqe_sched = true;
+        core->cqe_bulk_bytes = MMC_CQE_BULK_BYTES;
+        core->cqe_bulk_max = MMC_CQE_BULK_MAX;
 
         /*
          * By default, hosts do not support SGIO or large requests.
@@ -199,23 +290,61 @@ struct mmc_host *mmc_alloc_host(int extra, struct device *dev)
 
 EXPORT_SYMBOL(mmc_alloc_host);
 
-int mmc_retune(struct mmc_host *host)
+/*
+ * Check that the sample point found by the last tuning still works at the
+ * current timing and clock. HS200 and SDR104 send a single tuning block.
+ * HS400 does not allow the tuning command, and reads there go through the
+ * strobe and its DLL rather than the tuned point, so nothing short of a
+ * full tuning proves it: always take that path.
+ */
+static int mmc_retune_verify(struct mmc_host *host)
 {
-        bool return_to_hs400 = false;
-        int err;
+        struct mmc_core_host *core = mmc_core_host(host);
+        struct mmc_card *card = host->card;
+        u32 opcode;
 
-        if (host->retune_now)
-                host->retune_now = 0;
+        if (host->ios.timing == MMC_TIMING_MMC_HS400 ||
+            host->ios.enhanced_strobe)
+                return -EOPNOTSUPP;
+
+        if (!core->tuned || core->tuned_timing != host->ios.timing ||
+            core->tuned_clock != host->ios.clock)
+                return -EINVAL;
+
+        if (mmc_card_mmc(card))
+                opcode = MMC_SEND_TUNING_BLOCK_HS200;
         else
-                return 0;
+                opcode = MMC_SEND_TUNING_BLOCK;
 
-        if (!host->need_retune || host->doing_retune || !host->card)
-                return 0;
- 
-        host->need_retune = 0;
+        return mmc_send_tuning(host, opcode, NULL);
+}
+
+static int __mmc_retune(struct mmc_host *host)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+        bool return_to_hs400 = false;
+        int err;
 
         host->doing_retune = 1;
 
+        /*
+         * A periodic re-tune with no CRC error or host request behind it
+         * only has to prove the cached sample point, fall back to a full
+         * tuning if that fails.
+         */
+        if (!host->need_retune) {
+                core->retune_periodic = false;
+                err = mmc_retune_verify(host);
+                if (!err) {
+                        core->retune_verified++;
+                        mmc_retune_enable(host);
+                        goto out;
+                }
+        }
+
+        host->need_retune = 0;
+        core->retune_periodic = false;
+
         if (host->ios.timing == MMC_TIMING_MMC_HS400) {
                 err = mmc_hs400_to_hs200(host->card);
                 if (err)
@@ -236,6 +365,200 @@ out:
         return err;
 }
 
+int mmc_retune(struct mmc_host *host)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        if (host->retune_now)
+                host->retune_now = 0;
+        else
+                return 0;
+
+        if (host->doing_retune || !host->card)
+                return 0;
+
+        if (!host->need_retune &&
+            (core->clk_scaled_down || !(core->retune_periodic &&
+              time_after(jiffies, core->retune_deadline))))
+                return 0;
+
+        return __mmc_retune(host);
+}
+
+/*
+ * Load-driven bus clock scaling. mmc_clk_scale_work() samples the request
+ * count every clk_scale_period_ms and drops an idle-ish bus to
+ * clk_scale_low. Once requests arrive, the request path brings the clock
+ * back to the one the card was initialised at within clk_scale_up_ms, or
+ * as soon as clk_scale_up_bytes have been asked for, and proves the cached
+ * tuning there instead of tuning again. HS400 is left alone, its clock is
+ * tied to the strobe and the HS200 round trip.
+ */
+static unsigned long mmc_clk_scale_period(struct mmc_core_host *core)
+{
+        return msecs_to_jiffies(max(core->clk_scale_period_ms, 1U));
+}
+
+static bool mmc_clk_scale_allowed(struct mmc_host *host)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        return host->card && core->clk_scale_max &&
+               !host->ios.enhanced_strobe &&
+               host->ios.timing != MMC_TIMING_MMC_HS400 &&
+               core->clk_scale_low >= host->f_min &&
+               core->clk_scale_low < host->ios.clock;
+}
+
+static void mmc_clk_scale_down(struct mmc_host *host)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        if (core->clk_scaled_down || !mmc_clk_scale_allowed(host))
+                return;
+
+        if (host->cqe_on)
+                host->cqe_ops->cqe_off(host);
+
+        host->ios.clock = core->clk_scale_low;
+        mmc_set_ios(host);
+
+        core->clk_scaled_down = true;
+        core->clk_scale_load_start = 0;
+        core->clk_scale_load_bytes = 0;
+        core->clk_scale_downs++;
+}
+
+static void mmc_clk_scale_up(struct mmc_host *host)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        if (!core->clk_scaled_down)
+                return;
+
+        core->clk_scaled_down = false;
+        core->clk_scale_load_start = 0;
+        core->clk_scale_load_bytes = 0;
+
+        /* Whoever moved the clock since the scale-down owns it now */
+        if (!host->card || host->ios.clock != core->clk_scale_low ||
+            !core->clk_scale_max)
+                return;
+
+        core->clk_scale_ups++;
+
+        if (host->cqe_on)
+                host->cqe_ops->cqe_off(host);
+
+        host->ios.clock = core->clk_scale_max;
+        mmc_set_ios(host);
+
+        /*
+         * Only a verify command when the cached sample point still holds.
+         * If that fails, have the next request run a full tuning.
+         */
+        if (core->tuned && !host->doing_retune &&
+            (host->ios.timing == MMC_TIMING_MMC_HS200 ||
+             host->ios.timing == MMC_TIMING_UHS_SDR104) &&
+            __mmc_retune(host))
+                mmc_retune_needed(host);
+}
+
+/*
+ * Forget any scaling state once the card is (re-)initialised: it sets the
+ * bus clock from scratch, and mmc_set_clock() records the new maximum.
+ */
+void mmc_clk_scale_reset(struct mmc_host *host)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        core->clk_scaled_down = false;
+        core->clk_scale_max = 0;
+        core->clk_scale_reqs = 0;
+        core->clk_scale_load_start = 0;
+        core->clk_scale_load_bytes = 0;
+}
+
+/* Called with the host claimed, before a request is issued */
+void mmc_clk_scale_account(struct mmc_host *host, struct mmc_request *mrq)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        if (!core->clk_scale_enabled)
+                return;
+
+        core->clk_scale_reqs++;
+
+        /* The clock only changes with nothing queued on CQE */
+        if (!core->clk_scaled_down || host->doing_retune ||
+            atomic_read(&core->cqe_in_flight))
+                return;
+
+        if (!core->clk_scale_load_start)
+                core->clk_scale_load_start = jiffies ?: 1;
+
+        if (mrq->data)
+                core->clk_scale_load_bytes += mrq->data->blksz *
+                                              mrq->data->blocks;
+
+        if (core->clk_scale_load_bytes >= core->clk_scale_up_bytes ||
+            time_after_eq(jiffies, core->clk_scale_load_start +
+                          msecs_to_jiffies(core->clk_scale_up_ms)))
+                mmc_clk_scale_up(host);
+}
+
+static void mmc_clk_scale_work(struct work_struct *work)
+{
+        struct mmc_core_host *core = container_of(work, struct mmc_core_host,
+                                                  clk_scale_work.work);
+        struct mmc_host *host = &core->host;
+
+        if (!core->clk_scale_enabled)
+                return;
+
+        /* Don't wake a suspended host just to find it idle */
+        if (!pm_runtime_suspended(mmc_dev(host)) && mmc_try_claim_host(host)) {
+                if (core->clk_scale_reqs <= core->clk_scale_down_reqs &&
+                    host->card && !pm_runtime_suspended(&host->card->dev))
+                        mmc_clk_scale_down(host);
+                core->clk_scale_reqs = 0;
+                mmc_release_host(host);
+        }
+
+        queue_delayed_work(system_freezable_wq, &core->clk_scale_work,
+                           mmc_clk_scale_period(core));
+}
+
+/**
+ *      mmc_clk_scale_enable - turn load-driven clock scaling on or off
+ *      @host: mmc host
+ *      @enable: new state
+ *
+ *      Turning scaling off returns the bus to its full clock.
+ */
+void mmc_clk_scale_enable(struct mmc_host *host, bool enable)
+{
+        struct mmc_core_host *core = mmc_core_host(host);
+
+        if (enable == core->clk_scale_enabled)
+                return;
+
+        core->clk_scale_enabled = enable;
+
+        if (enable) {
+                core->clk_scale_reqs = 0;
+                queue_delayed_work(system_freezable_wq, &core->clk_scale_work,
+                                   mmc_clk_scale_period(core));
+                return;
+        }
+
+        cancel_delayed_work_sync(&core->clk_scale_work);
+
+        mmc_claim_host(host);
+        mmc_clk_scale_up(host);
+        mmc_release_host(host);
+}
+
 /**
  *      mmc_free_host - free the host structure
  *      @host: mmc host
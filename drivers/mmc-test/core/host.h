@@ -11,8 +11,81 @@
 #ifndef _MMC_CORE_HOST_H
 #define _MMC_CORE_HOST_H
 
+#include <linux/ktime.h>
+#include <linux/mutex.h>
 #include <linux/mmc/host.h>
 
+/*
+ * Core-private per-host state. struct mmc_host is shared with the host
+ * drivers, so state that only the core cares about lives in this wrapper,
+ * which mmc_alloc_host() allocates around the mmc_host. The mmc_host must
+ * stay the last member so that mmc_priv() still points past the end of the
+ * allocation.
+ */
+struct mmc_core_host {
+	/* EXT_CSD resume cache, see mmc_init_card() */
+	bool			ext_csd_valid;
+	unsigned int		ext_csd_bus_width;
+
+	/* Last good tuning, see mmc_retune() */
+	bool			tuned;
+	unsigned char		tuned_timing;
+	unsigned int		tuned_clock;
+	bool			retune_periodic;
+	unsigned int		tuning_count;
+	unsigned int		tuning_errors;
+	unsigned int		retune_verified;
+	unsigned long		retune_deadline;
+	struct delayed_work	retune_work;
+	/* Load-driven bus clock scaling, see mmc_clk_scale_work() */
+	bool			clk_scale_enabled;
+	bool			clk_scaled_down;
+	unsigned int		clk_scale_max;		/* Clock set up by init */
+	unsigned int		clk_scale_low;		/* Hz */
+	unsigned int		clk_scale_period_ms;	/* Load sampling window */
+	unsigned int		clk_scale_down_reqs;	/* Idle at or below this */
+	unsigned int		clk_scale_up_ms;	/* Ramp-up latency bound */
+	unsigned int		clk_scale_up_bytes;	/* ... or this much data */
+	unsigned int		clk_scale_reqs;		/* In the current window */
+	unsigned long		clk_scale_load_start;	/* First request while low */
+	u64			clk_scale_load_bytes;
+	unsigned int		clk_scale_ups;
+	unsigned int		clk_scale_downs;
+	struct delayed_work	clk_scale_work;
+	/* Command queue engine, see mmc_cqe_start_req() */
+	unsigned long		cqe_tags;		/* Allocated task tags */
+	unsigned int		cqe_tag_hint;		/* Where to look next */
+	const struct mmc_cqe_ext_ops *cqe_ext_ops;	/* See core/cqe.h */
+	atomic_t		cqe_in_flight;		/* Queued, DCMD included */
+	bool			cqe_recovery_needed;
+	struct mutex		cqe_dcmd_lock;		/* One DCMD at a time */
+	unsigned int		cqe_dcmds;
+	bool			cqe_sched;		/* See mmc_cqe_admit() */
+	u32			cqe_bulk_bytes;		/* Bulk from this size */
+	u32			cqe_bulk_max;		/* Bulk writes queued */
+	atomic_t		cqe_bulk_writes;
+	atomic_t		cqe_writes;		/* Any size, queued */
+	unsigned int		cqe_throttled;
+	ktime_t			cqe_issued[BITS_PER_LONG];
+	/* Issue to completion, [0] reads, [1] writes */
+	u64			cqe_done[2];
+	u64			cqe_ns[2];
+	u64			cqe_max_ns[2];
+	/* eMMC contexts, see mmc_context_open() */
+	unsigned int		context_max;		/* Highest ID, 0 if none */
+	u8			context_conf[15];	/* Mode of IDs 1-15 */
+	u64			context_reqs;		/* Sent in a context */
+	u64			data_tag_reqs;		/* Sent with the tag */
+	unsigned int		data_tag_unaligned;	/* Tag dropped */
+
+	struct mmc_host		host;
+};
+
+static inline struct mmc_core_host *mmc_core_host(struct mmc_host *host)
+{
+	return container_of(host, struct mmc_core_host, host);
+}
+
 int mmc_register_host_class(void);
 void mmc_unregister_host_class(void);
 
@@ -23,6 +96,9 @@ void mmc_retune_release(struct mmc_host *host);
 int mmc_retune(struct mmc_host *host);
 void mmc_retune_pause(struct mmc_host *host);
 void mmc_retune_unpause(struct mmc_host *host);
+void mmc_clk_scale_account(struct mmc_host *host, struct mmc_request *mrq);
+void mmc_clk_scale_reset(struct mmc_host *host);
+void mmc_clk_scale_enable(struct mmc_host *host, bool enable);
 
 static inline void mmc_retune_hold_now(struct mmc_host *host)
 {
@@ -364,6 +364,7 @@ static void mmc_manage_gp_partitions(struct mmc_card *card, u8 *ext_csd)
  */
 static int mmc_decode_ext_csd(struct mmc_card *card, u8 *ext_csd)
 {
+	struct mmc_core_host *core = mmc_core_host(card->host);
 	int err = 0, idx;
 	unsigned int part_size;
 	struct device_node *np;
@@ -584,6 +585,7 @@ static int mmc_decode_ext_csd(struct mmc_card *card, u8 *ext_csd)
 
 	/* eMMC v4.5 or later */
 	card->ext_csd.generic_cmd6_time = DEFAULT_CMD6_TIMEOUT_MS;
+	core->context_max = 0;
 	if (card->ext_csd.rev >= 6) {
 		card->ext_csd.feature_support |= MMC_DISCARD_FEATURE;
 
@@ -592,6 +594,9 @@ static int mmc_decode_ext_csd(struct mmc_card *card, u8 *ext_csd)
 		card->ext_csd.power_off_longtime = 10 *
 			ext_csd[EXT_CSD_POWER_OFF_LONG_TIME];
 
+		core->context_max = ext_csd[EXT_CSD_CONTEXT_CAPABILITIES] &
+			EXT_CSD_MAX_CONTEXT_ID_MASK;
+
 		card->ext_csd.cache_size =
 			ext_csd[EXT_CSD_CACHE_SIZE + 0] << 0 |
 			ext_csd[EXT_CSD_CACHE_SIZE + 1] << 8 |
@@ -694,14 +699,11 @@ static int mmc_read_ext_csd(struct mmc_card *card)
 	return err;
 }
 
-static int mmc_compare_ext_csds(struct mmc_card *card, unsigned bus_width)
+static int __mmc_compare_ext_csds(struct mmc_card *card)
 {
 	u8 *bw_ext_csd;
 	int err;
 
-	if (bus_width == MMC_BUS_WIDTH_1)
-		return 0;
-
 	err = mmc_get_ext_csd(card, &bw_ext_csd);
 	if (err)
 		return err;
@@ -767,6 +769,45 @@ static int mmc_compare_ext_csds(struct mmc_card *card, unsigned bus_width)
 	return err;
 }
 
+static int mmc_compare_ext_csds(struct mmc_card *card, unsigned bus_width)
+{
+	if (bus_width == MMC_BUS_WIDTH_1)
+		return 0;
+
+	return __mmc_compare_ext_csds(card);
+}
+
+/*
+ * The CSD read back from a resumed card no longer matches the cached one,
+ * so the EXT_CSD decoded at first init can't be trusted blindly either.
+ * Read it once more and keep the old card only if none of its read only
+ * fields changed, otherwise report it as a different card.
+ */
+static int mmc_revalidate_ext_csd(struct mmc_card *card, u32 *csd)
+{
+	struct mmc_core_host *core = mmc_core_host(card->host);
+	int err;
+
+	core->ext_csd_bus_width = 0;
+
+	if (mmc_can_ext_csd(card)) {
+		err = __mmc_compare_ext_csds(card);
+		if (err == -EINVAL)
+			err = -ENOENT;
+		if (err)
+			return err;
+	}
+
+	memcpy(card->raw_csd, csd, sizeof(card->raw_csd));
+	err = mmc_decode_csd(card);
+	if (err)
+		return err;
+
+	mmc_set_erase_size(card);
+
+	return 0;
+}
+
 MMC_DEV_ATTR(cid, "%08x%08x%08x%08x\n", card->raw_cid[0], card->raw_cid[1],
 	card->raw_cid[2], card->raw_cid[3]);
 MMC_DEV_ATTR(csd, "%08x%08x%08x%08x\n", card->raw_csd[0], card->raw_csd[1],
@@ -994,6 +1035,7 @@ static int mmc_select_bus_width(struct mmc_card *card)
 		MMC_BUS_WIDTH_4,
 	};
 	struct mmc_host *host = card->host;
+	struct mmc_core_host *core = mmc_core_host(host);
 	unsigned idx, bus_width = 0;
 	int err = 0;
 
@@ -1003,6 +1045,13 @@ static int mmc_select_bus_width(struct mmc_card *card)
 
 	idx = (host->caps & MMC_CAP_8_BIT_DATA) ? 0 : 1;
 
+	/*
+	 * A resumed card whose cache validated can go straight back to the
+	 * width that passed the check last time.
+	 */
+	if (core->ext_csd_valid && core->ext_csd_bus_width == MMC_BUS_WIDTH_4)
+		idx = 1;
+
 	/*
 	 * Unlike SD, MMC cards dont have a configuration register to notify
 	 * supported bus width. So bus test command should be run to identify
@@ -1032,12 +1081,15 @@ static int mmc_select_bus_width(struct mmc_card *card)
 		 * compare ext_csd previously read in 1 bit mode
 		 * against ext_csd at new bus width
 		 */
-		if (!(host->caps & MMC_CAP_BUS_WIDTH_TEST))
+		if (core->ext_csd_valid && bus_width == core->ext_csd_bus_width)
+			err = 0;
+		else if (!(host->caps & MMC_CAP_BUS_WIDTH_TEST))
 			err = mmc_compare_ext_csds(card, bus_width);
 		else
 			err = mmc_bus_test(card, bus_width);
 
 		if (!err) {
+			core->ext_csd_bus_width = bus_width;
 			err = bus_width;
 			break;
 		} else {
@@ -1548,10 +1600,13 @@ static int mmc_hs200_tuning(struct mmc_card *card)
 static int mmc_init_card(struct mmc_host *host, u32 ocr,
 	struct mmc_card *oldcard)
 {
+	struct mmc_core_host *core = mmc_core_host(host);
 	struct mmc_card *card;
 	int err;
 	u32 cid[4];
+	u32 csd[4];
 	u32 rocr;
+	bool reread_ext_csd = false;
 
 	WARN_ON(!host->claimed);
 
@@ -1610,6 +1665,9 @@ static int mmc_init_card(struct mmc_host *host, u32 ocr,
 		card->type = MMC_TYPE_MMC;
 		card->rca = 1;
 		memcpy(card->raw_cid, cid, sizeof(card->raw_cid));
+
+		core->ext_csd_valid = false;
+		core->ext_csd_bus_width = 0;
 	}
 
 	/*
@@ -1643,6 +1701,20 @@ static int mmc_init_card(struct mmc_host *host, u32 ocr,
 		err = mmc_decode_cid(card);
 		if (err)
 			goto free_card;
+	} else {
+		/*
+		 * The decoded registers of the old card are reused. The CSD
+		 * costs a single R2 response, so read it back as a cheap
+		 * check that they still describe this card, and only fall
+		 * back to reading EXT_CSD again when it changed.
+		 */
+		err = mmc_send_csd(card, csd);
+		if (err)
+			goto free_card;
+
+		if (!core->ext_csd_valid ||
+		    memcmp(csd, card->raw_csd, sizeof(csd)) != 0)
+			reread_ext_csd = true;
 	}
 
 	/*
@@ -1678,6 +1750,10 @@ static int mmc_init_card(struct mmc_host *host, u32 ocr,
 
 		/* Erase size depends on CSD and Extended CSD */
 		mmc_set_erase_size(card);
+	} else if (reread_ext_csd) {
+		err = mmc_revalidate_ext_csd(card, csd);
+		if (err)
+			goto free_card;
 	}
 
 	/* Enable ERASE_GRP_DEF. This bit is lost after a reset or power off. */
@@ -1818,6 +1894,12 @@ static int mmc_init_card(struct mmc_host *host, u32 ocr,
 		}
 	}
 
+	/* Power loss closes every context, a new card has none open */
+	if (oldcard)
+		mmc_context_restore(card);
+	else
+		memset(core->context_conf, 0, sizeof(core->context_conf));
+
 	/*
 	 * Enable Command Queue if supported. Note that Packed Commands cannot
 	 * be used with Command Queue.
@@ -1865,9 +1947,12 @@ static int mmc_init_card(struct mmc_host *host, u32 ocr,
 	if (!oldcard)
 		host->card = card;
 
+	core->ext_csd_valid = true;
+
 	return 0;
 
 free_card:
+	core->ext_csd_valid = false;
 	if (!oldcard)
 		mmc_remove_card(card);
 err:
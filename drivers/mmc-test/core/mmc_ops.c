@@ -65,7 +65,10 @@ int __mmc_send_status(struct mmc_card *card, u32 *status, unsigned int retries)
 		cmd.arg = card->rca << 16;
 	cmd.flags = MMC_RSP_SPI_R2 | MMC_RSP_R1 | MMC_CMD_AC;
 
-	err = mmc_wait_for_cmd(card->host, &cmd, retries);
+	/* Polling status must not halt a running CQE */
+	err = mmc_cqe_wait_for_dcmd(card->host, &cmd, retries);
+	if (err == -EOPNOTSUPP)
+		err = mmc_wait_for_cmd(card->host, &cmd, retries);
 	if (err)
 		return err;
 
@@ -505,6 +508,22 @@ static int mmc_poll_for_busy(struct mmc_card *card, unsigned int timeout_ms,
 	return 0;
 }
 
+/*
+ * Switches that leave the bus, the partition and the queue as they are,
+ * and so can go out as a CQE direct command between queued tasks.
+ */
+static bool mmc_switch_can_dcmd(u8 index)
+{
+	switch (index) {
+	case EXT_CSD_FLUSH_CACHE:
+	case EXT_CSD_BKOPS_START:
+		return true;
+	default:
+		return index >= EXT_CSD_CONTEXT_CONF &&
+		       index < EXT_CSD_CONTEXT_CONF + 15;
+	}
+}
+
 /**
  *	__mmc_switch - modify EXT_CSD register
  *	@card: the MMC card associated with the data transfer
@@ -529,6 +548,7 @@ int __mmc_switch(struct mmc_card *card, u8 set, u8 index, u8 value,
 	struct mmc_command cmd = {};
 	bool use_r1b_resp = use_busy_signal;
 	unsigned char old_timing = host->ios.timing;
+	bool dcmd = false;
 
 	mmc_retune_hold(host);
 
@@ -562,7 +582,14 @@ int __mmc_switch(struct mmc_card *card, u8 set, u8 index, u8 value,
 	if (index == EXT_CSD_SANITIZE_START)
 		cmd.sanitize_busy = true;
 
-	err = mmc_wait_for_cmd(host, &cmd, MMC_CMD_RETRIES);
+	/* With CQE on, queue the switch rather than halt the engine */
+	err = -EOPNOTSUPP;
+	if (!timing && mmc_switch_can_dcmd(index))
+		err = mmc_cqe_wait_for_dcmd(host, &cmd, MMC_CMD_RETRIES);
+	if (err == -EOPNOTSUPP)
+		err = mmc_wait_for_cmd(host, &cmd, MMC_CMD_RETRIES);
+	else
+		dcmd = true;
 	if (err)
 		goto out;
 
@@ -570,8 +597,11 @@ int __mmc_switch(struct mmc_card *card, u8 set, u8 index, u8 value,
 	if (!use_busy_signal)
 		goto out;
 
-	/*If SPI or used HW busy detection above, then we don't need to poll. */
-	if (((host->caps & MMC_CAP_WAIT_WHILE_BUSY) && use_r1b_resp) ||
+	/*
+	 * If SPI or used HW busy detection above, then we don't need to poll.
+	 * The engine waits out the busy of an R1b DCMD itself.
+	 */
+	if (((host->caps & MMC_CAP_WAIT_WHILE_BUSY || dcmd) && use_r1b_resp) ||
 		mmc_host_is_spi(host))
 		goto out_tim;
 
@@ -1059,3 +1089,104 @@ int mmc_cmdq_disable(struct mmc_card *card)
 	return mmc_cmdq_switch(card, false);
 }
 EXPORT_SYMBOL_GPL(mmc_cmdq_disable);
+
+static int mmc_context_switch(struct mmc_card *card, unsigned int id, u8 mode)
+{
+	return mmc_switch(card, EXT_CSD_CMD_SET_NORMAL,
+			  EXT_CSD_CONTEXT_CONF + id - 1, mode,
+			  card->ext_csd.generic_cmd6_time);
+}
+
+/**
+ * mmc_context_open - open an eMMC context for a stream of data
+ * @card: the MMC card
+ * @mode: MMC_CONTEXT_WRITE, MMC_CONTEXT_READ or MMC_CONTEXT_RW
+ *
+ * Returns the ID to place the stream's transfers in with
+ * mmc_cqe_set_stream(), -EOPNOTSUPP if the card has no contexts or
+ * -ENOSPC if they are all open. This is a CMD6 switch, so the host must
+ * be claimed with no CQE tasks queued.
+ */
+int mmc_context_open(struct mmc_card *card, unsigned int mode)
+{
+	struct mmc_core_host *core = mmc_core_host(card->host);
+	unsigned int id;
+	int err;
+
+	if (!core->context_max)
+		return -EOPNOTSUPP;
+
+	if (!mode || mode & ~MMC_CONTEXT_RW)
+		return -EINVAL;
+
+	if (atomic_read(&core->cqe_in_flight))
+		return -EBUSY;
+
+	for (id = 1; id <= core->context_max; id++)
+		if (!core->context_conf[id - 1])
+			break;
+	if (id > core->context_max)
+		return -ENOSPC;
+
+	err = mmc_context_switch(card, id, mode);
+	if (err)
+		return err;
+
+	core->context_conf[id - 1] = mode;
+
+	return id;
+}
+EXPORT_SYMBOL_GPL(mmc_context_open);
+
+/**
+ * mmc_context_close - close a context opened by mmc_context_open()
+ * @card: the MMC card
+ * @id: context ID
+ *
+ * The card may flush the context's data before it completes the switch.
+ * The context stays open if that fails.
+ */
+int mmc_context_close(struct mmc_card *card, unsigned int id)
+{
+	struct mmc_core_host *core = mmc_core_host(card->host);
+	int err;
+
+	if (!id || id > core->context_max || !core->context_conf[id - 1])
+		return -EINVAL;
+
+	if (atomic_read(&core->cqe_in_flight))
+		return -EBUSY;
+
+	err = mmc_context_switch(card, id, 0);
+	if (err)
+		return err;
+
+	core->context_conf[id - 1] = 0;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(mmc_context_close);
+
+/*
+ * CONTEXT_CONF does not survive a power cycle: reopen the contexts that
+ * are still in use. One that cannot be reopened is dropped, and its
+ * transfers go out without a context.
+ */
+void mmc_context_restore(struct mmc_card *card)
+{
+	struct mmc_core_host *core = mmc_core_host(card->host);
+	unsigned int id;
+	int err;
+
+	for (id = 1; id <= core->context_max; id++) {
+		if (!core->context_conf[id - 1])
+			continue;
+
+		err = mmc_context_switch(card, id, core->context_conf[id - 1]);
+		if (err) {
+			pr_warn("%s: failed to reopen context %u, error %d\n",
+				mmc_hostname(card->host), id, err);
+			core->context_conf[id - 1] = 0;
+		}
+	}
+}
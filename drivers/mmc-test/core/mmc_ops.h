@@ -17,6 +17,11 @@
 struct mmc_host;
 struct mmc_card;
 
+/* eMMC 4.5 context management, missing from <linux/mmc/mmc.h> */
+#define EXT_CSD_CONTEXT_CONF		37	/* R/W, one byte per ID 1-15 */
+#define EXT_CSD_CONTEXT_CAPABILITIES	57	/* RO */
+#define EXT_CSD_MAX_CONTEXT_ID_MASK	0xF
+
 int mmc_select_card(struct mmc_card *card);
 int mmc_deselect_cards(struct mmc_host *host);
 int mmc_set_dsr(struct mmc_host *host);
@@ -45,6 +50,9 @@ void mmc_start_bkops(struct mmc_card *card, bool from_exception);
 int mmc_flush_cache(struct mmc_card *card);
 int mmc_cmdq_enable(struct mmc_card *card);
 int mmc_cmdq_disable(struct mmc_card *card);
+int mmc_context_open(struct mmc_card *card, unsigned int mode);
+int mmc_context_close(struct mmc_card *card, unsigned int id);
+void mmc_context_restore(struct mmc_card *card);
 
 #endif
 
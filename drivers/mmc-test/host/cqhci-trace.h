@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cqhci
+
+#if !defined(_TRACE_CQHCI_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CQHCI_H
+
+#include <linux/tracepoint.h>
+#include <linux/mmc/host.h>
+
+TRACE_EVENT(cqhci_task_issue,
+
+	TP_PROTO(struct mmc_host *mmc, unsigned int tag, int qcnt),
+
+	TP_ARGS(mmc, tag, qcnt),
+
+	TP_STRUCT__entry(
+		__string(name,		mmc_hostname(mmc))
+		__field(unsigned int,	tag)
+		__field(int,		qcnt)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, mmc_hostname(mmc));
+		__entry->tag = tag;
+		__entry->qcnt = qcnt;
+	),
+
+	TP_printk("%s: tag=%u qcnt=%d",
+		  __get_str(name), __entry->tag, __entry->qcnt)
+);
+
+TRACE_EVENT(cqhci_task_done,
+
+	TP_PROTO(struct mmc_host *mmc, unsigned int tag, u64 service_ns,
+		 int qcnt),
+
+	TP_ARGS(mmc, tag, service_ns, qcnt),
+
+	TP_STRUCT__entry(
+		__string(name,		mmc_hostname(mmc))
+		__field(unsigned int,	tag)
+		__field(u64,		service_ns)
+		__field(int,		qcnt)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, mmc_hostname(mmc));
+		__entry->tag = tag;
+		__entry->service_ns = service_ns;
+		__entry->qcnt = qcnt;
+	),
+
+	TP_printk("%s: tag=%u service_ns=%llu qcnt=%d",
+		  __get_str(name), __entry->tag, __entry->service_ns,
+		  __entry->qcnt)
+);
+
+#endif /* _TRACE_CQHCI_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE cqhci-trace
+#include <trace/define_trace.h>
@@ -10,21 +10,29 @@
  * GNU General Public License for more details.
  */
 
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/fault-inject.h>
 #include <linux/highmem.h>
 #include <linux/io.h>
 #include <linux/module.h>
 #include <linux/dma-mapping.h>
 #include <linux/slab.h>
 #include <linux/scatterlist.h>
+#include <linux/sizes.h>
 #include <linux/platform_device.h>
 #include <linux/ktime.h>
+#include <linux/seq_file.h>
 
 #include <linux/mmc/mmc.h>
 #include <linux/mmc/host.h>
 #include <linux/mmc/card.h>
 
 #include "cqhci.h"
+#include "../core/cqe.h"
+
+#define CREATE_TRACE_POINTS
+#include "cqhci-trace.h"
 
 #define DCMD_SLOT 31
 #define NUM_SLOTS 32
@@ -37,8 +45,16 @@ struct cqhci_slot {
 #define CQHCI_HOST_CRC		BIT(2)
 #define CQHCI_HOST_TIMEOUT	BIT(3)
 #define CQHCI_HOST_OTHER	BIT(4)
+	/* pool descriptor carrying END, -1 if the slot does not map the pool */
+	int pool_end;
+	/* doorbell and TCN, see cqhci_account_done() */
+	ktime_t issue_time;
+	ktime_t done_time;
 };
 
+#define CQHCI_SLOT_ERRORS	(CQHCI_EXTERNAL_TIMEOUT | CQHCI_HOST_CRC | \
+				 CQHCI_HOST_TIMEOUT | CQHCI_HOST_OTHER)
+
 static inline u8 *get_desc(struct cqhci_host *cq_host, u8 tag)
 {
 	return cq_host->desc_base + (tag * cq_host->slot_sz);
@@ -64,6 +80,10 @@ static inline u8 *get_trans_desc(struct cqhci_host *cq_host, u8 tag)
 		(cq_host->trans_desc_len * cq_host->mmc->max_segs * tag);
 }
 
+static void cqhci_pool_build(struct cqhci_host *cq_host, u8 tag);
+static void cqhci_pool_enable(struct cqhci_host *cq_host);
+static void cqhci_pool_free(struct cqhci_host *cq_host);
+
 static void setup_trans_desc(struct cqhci_host *cq_host, u8 tag)
 {
 	u8 *link_temp;
@@ -72,6 +92,8 @@ static void setup_trans_desc(struct cqhci_host *cq_host, u8 tag)
 	link_temp = get_link_desc(cq_host, tag);
 	trans_temp = get_trans_desc_dma(cq_host, tag);
 
+	cq_host->slot[tag].pool_end = -1;
+
 	memset(link_temp, 0, cq_host->link_desc_len);
 	if (cq_host->link_desc_len > 8)
 		*(link_temp + 8) = 0;
@@ -92,11 +114,18 @@ static void setup_trans_desc(struct cqhci_host *cq_host, u8 tag)
 
 		data_addr[0] = cpu_to_le32(trans_temp);
 	}
+
+	/* pool transfers only patch the END descriptor per request */
+	if (cq_host->pool_bufs)
+		cqhci_pool_build(cq_host, tag);
 }
 
 static void cqhci_set_irqs(struct cqhci_host *cq_host, u32 set)
 {
 	cqhci_writel(cq_host, set, CQHCI_ISTE);
+	/* In poll mode completions are only latched, see cqhci_poll() */
+	if (cq_host->poll_mode)
+		set &= ~CQHCI_IS_TCC;
 	cqhci_writel(cq_host, set, CQHCI_ISGE);
 }
 
@@ -244,6 +273,56 @@ static int cqhci_host_alloc_tdl(struct cqhci_host *cq_host)
 	return 0;
 }
 
+/*
+ * Interrupt coalescing: with ic_count set, the engine raises one interrupt
+ * per ic_count completions, or once the oldest unreported completion is
+ * ic_timeout timer units old. A task descriptor with INT set is reported
+ * right away regardless, which is what tasks that cannot wait get: DCMDs,
+ * MMC_DATA_PRIO transfers, and in adaptive mode anything issued while
+ * fewer than ic_adapt_depth tasks are queued, when there is not enough
+ * traffic to amortise the wait.
+ */
+static void cqhci_set_ic(struct cqhci_host *cq_host)
+{
+	u32 ic = 0;
+
+	if (cq_host->ic_count)
+		ic = CQHCI_IC_ENABLE | CQHCI_IC_RESET |
+		     CQHCI_IC_ICCTHWEN | CQHCI_IC_ICCTH(cq_host->ic_count) |
+		     CQHCI_IC_ICTOVALWEN | CQHCI_IC_ICTOVAL(cq_host->ic_timeout);
+
+	cqhci_writel(cq_host, ic, CQHCI_IC);
+}
+
+static bool cqhci_task_intr(struct cqhci_host *cq_host,
+			    struct mmc_request *mrq)
+{
+	if (!cq_host->ic_count || (mrq->data->flags & MMC_DATA_PRIO))
+		return true;
+
+	return cq_host->ic_adaptive &&
+	       READ_ONCE(cq_host->qcnt) < cq_host->ic_adapt_depth;
+}
+
+/*
+ * Errors, halt and task clear still interrupt in poll mode, see
+ * mmc_cqe_set_poll(). Waiting for idle and timeout handling poll by
+ * themselves. Direct commands are refused with -EOPNOTSUPP meanwhile, so
+ * the core sends them the usual way.
+ */
+static void cqhci_set_poll(struct mmc_host *mmc, bool poll)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cq_host->lock, flags);
+	cq_host->poll_mode = poll;
+	/* recovery restores the interrupt mask when it is done */
+	if (cq_host->activated && !cq_host->recovery_halt)
+		cqhci_set_irqs(cq_host, CQHCI_IS_MASK);
+	spin_unlock_irqrestore(&cq_host->lock, flags);
+}
+
 static void __cqhci_enable(struct cqhci_host *cq_host)
 {
 	struct mmc_host *mmc = cq_host->mmc;
@@ -274,6 +353,8 @@ static void __cqhci_enable(struct cqhci_host *cq_host)
 
 	cqhci_writel(cq_host, cq_host->rca, CQHCI_SSC2);
 
+	cqhci_set_ic(cq_host);
+
 	cqhci_set_irqs(cq_host, 0);
 
 	cqcfg |= CQHCI_ENABLE;
@@ -331,6 +412,201 @@ int cqhci_resume(struct mmc_host *mmc)
 }
 EXPORT_SYMBOL(cqhci_resume);
 
+static int cqhci_ic_stats_show(struct seq_file *s, void *data)
+{
+	struct cqhci_host *cq_host = s->private;
+	u64 tasks = 0;
+	int i;
+
+	for (i = 1; i < ARRAY_SIZE(cq_host->irq_tasks); i++)
+		tasks += (u64)i * cq_host->irq_tasks[i];
+
+	seq_printf(s, "irqs:\t\t%u\n", cq_host->irqs);
+	seq_printf(s, "tasks:\t\t%llu\n", tasks);
+	seq_printf(s, "polls:\t\t%u\n", cq_host->polls);
+	seq_printf(s, "polled:\t\t%llu\n", cq_host->polled_tasks);
+
+	/* completions reaped per TCC interrupt, 0 when a poll got there first */
+	for (i = 0; i < ARRAY_SIZE(cq_host->irq_tasks); i++)
+		if (cq_host->irq_tasks[i])
+			seq_printf(s, "%d:\t\t%u\n", i, cq_host->irq_tasks[i]);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cqhci_ic_stats);
+
+static void cqhci_ic_update(struct cqhci_host *cq_host, u32 count,
+			    u32 timeout)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cq_host->lock, flags);
+	cq_host->ic_count = count;
+	cq_host->ic_timeout = timeout;
+	/* otherwise the next __cqhci_enable() programs it */
+	if (cq_host->activated)
+		cqhci_set_ic(cq_host);
+	spin_unlock_irqrestore(&cq_host->lock, flags);
+}
+
+static int cqhci_ic_count_get(void *data, u64 *val)
+{
+	struct cqhci_host *cq_host = data;
+
+	*val = cq_host->ic_count;
+
+	return 0;
+}
+
+static int cqhci_ic_count_set(void *data, u64 val)
+{
+	struct cqhci_host *cq_host = data;
+
+	/* ICCTH is 5 bits wide */
+	if (val > 0x1F)
+		return -EINVAL;
+
+	cqhci_ic_update(cq_host, val, cq_host->ic_timeout);
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(cqhci_ic_count_fops, cqhci_ic_count_get,
+			cqhci_ic_count_set, "%llu\n");
+
+static int cqhci_ic_timeout_get(void *data, u64 *val)
+{
+	struct cqhci_host *cq_host = data;
+
+	*val = cq_host->ic_timeout;
+
+	return 0;
+}
+
+static int cqhci_ic_timeout_set(void *data, u64 val)
+{
+	struct cqhci_host *cq_host = data;
+
+	/* ICTOVAL is 7 bits wide */
+	if (val > 0x7F)
+		return -EINVAL;
+
+	cqhci_ic_update(cq_host, cq_host->ic_count, val);
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(cqhci_ic_timeout_fops, cqhci_ic_timeout_get,
+			cqhci_ic_timeout_set, "%llu\n");
+
+static int cqhci_recovery_show(struct seq_file *s, void *data)
+{
+	struct cqhci_host *cq_host = s->private;
+	static const char * const kind[] = { "targeted", "full" };
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kind); i++) {
+		seq_printf(s, "%s:\t%u\n", kind[i], cq_host->recoveries[i]);
+		seq_printf(s, "%s_avg_ns:\t%llu\n", kind[i],
+			   cq_host->recoveries[i] ?
+			   div_u64(cq_host->recovery_ns[i],
+				   cq_host->recoveries[i]) : 0);
+		seq_printf(s, "%s_max_ns:\t%llu\n", kind[i],
+			   cq_host->recovery_max_ns[i]);
+	}
+	seq_printf(s, "fallbacks:\t%u\n", cq_host->recovery_fallbacks);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cqhci_recovery);
+
+static int cqhci_pool_show(struct seq_file *s, void *data)
+{
+	struct cqhci_host *cq_host = s->private;
+
+	seq_printf(s, "buf_size:\t%u\n", cq_host->pool_buf_size);
+	seq_printf(s, "requests:\t%llu\n", cq_host->pool_reqs);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cqhci_pool);
+
+static int cqhci_latency_show(struct seq_file *s, void *data)
+{
+	struct cqhci_host *cq_host = s->private;
+	int i;
+
+	seq_printf(s, "service_max_ns:\t%llu\n", cq_host->service_max_ns);
+
+	/* doorbell to TCN, and TCN to post_req, by upper bound in us */
+	seq_puts(s, "us\t\tservice\toverhead\n");
+	for (i = 0; i < CQHCI_HIST_BUCKETS; i++) {
+		if (!cq_host->service_hist[i] && !cq_host->overhead_hist[i])
+			continue;
+		if (i == CQHCI_HIST_BUCKETS - 1)
+			seq_printf(s, ">=%u:\t\t", 1U << (i - 1));
+		else
+			seq_printf(s, "<%u:\t\t", 1U << i);
+		seq_printf(s, "%u\t%u\n", cq_host->service_hist[i],
+			   cq_host->overhead_hist[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cqhci_latency);
+
+static int cqhci_occupancy_show(struct seq_file *s, void *data)
+{
+	struct cqhci_host *cq_host = s->private;
+	u64 total = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cq_host->qcnt_ns); i++)
+		total += cq_host->qcnt_ns[i];
+
+	/* time spent at each queue depth */
+	for (i = 0; i < ARRAY_SIZE(cq_host->qcnt_ns); i++)
+		if (cq_host->qcnt_ns[i])
+			seq_printf(s, "%d:\t\t%llu us\t%llu%%\n", i,
+				   div_u64(cq_host->qcnt_ns[i], NSEC_PER_USEC),
+				   div64_u64(cq_host->qcnt_ns[i] * 100, total));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cqhci_occupancy);
+
+static void cqhci_debugfs_init(struct cqhci_host *cq_host)
+{
+	struct dentry *root = cq_host->mmc->debugfs_root;
+
+	/* debugfs_root only exists once the host has been added */
+	if (cq_host->debugfs || !root)
+		return;
+
+	cq_host->debugfs = debugfs_create_dir("cqhci", root);
+	if (IS_ERR_OR_NULL(cq_host->debugfs))
+		return;
+
+	debugfs_create_file("ic_count", S_IRUSR | S_IWUSR, cq_host->debugfs,
+			    cq_host, &cqhci_ic_count_fops);
+	debugfs_create_file("ic_timeout", S_IRUSR | S_IWUSR, cq_host->debugfs,
+			    cq_host, &cqhci_ic_timeout_fops);
+	debugfs_create_bool("ic_adaptive", S_IRUSR | S_IWUSR, cq_host->debugfs,
+			    &cq_host->ic_adaptive);
+	debugfs_create_u32("ic_adapt_depth", S_IRUSR | S_IWUSR,
+			   cq_host->debugfs, &cq_host->ic_adapt_depth);
+	debugfs_create_file("ic_stats", S_IRUSR, cq_host->debugfs, cq_host,
+			    &cqhci_ic_stats_fops);
+	debugfs_create_bool("targeted_recovery", S_IRUSR | S_IWUSR,
+			    cq_host->debugfs, &cq_host->targeted_recovery);
+	debugfs_create_file("recovery", S_IRUSR, cq_host->debugfs, cq_host,
+			    &cqhci_recovery_fops);
+	debugfs_create_file("pool", S_IRUSR, cq_host->debugfs, cq_host,
+			    &cqhci_pool_fops);
+	debugfs_create_file("latency", S_IRUSR, cq_host->debugfs, cq_host,
+			    &cqhci_latency_fops);
+	debugfs_create_file("occupancy", S_IRUSR, cq_host->debugfs, cq_host,
+			    &cqhci_occupancy_fops);
+}
+
 static int cqhci_enable(struct mmc_host *mmc, struct mmc_card *card)
 {
 	struct cqhci_host *cq_host = mmc->cqe_private;
@@ -341,14 +617,21 @@ static int cqhci_enable(struct mmc_host *mmc, struct mmc_card *card)
 
 	cq_host->rca = card->rca;
 
+	/* before the descriptors, which point into the pool */
+	cqhci_pool_enable(cq_host);
+
 	err = cqhci_host_alloc_tdl(cq_host);
-	if (err)
+	if (err) {
+		cqhci_pool_free(cq_host);
 		return err;
+	}
 
 	__cqhci_enable(cq_host);
 
 	cq_host->enabled = true;
 
+	cqhci_debugfs_init(cq_host);
+
 #ifdef DEBUG
 	cqhci_dumpregs(cq_host);
 #endif
@@ -411,6 +694,8 @@ static void cqhci_disable(struct mmc_host *mmc)
 	cq_host->trans_desc_base = NULL;
 	cq_host->desc_base = NULL;
 
+	cqhci_pool_free(cq_host);
+
 	cq_host->enabled = false;
 }
 
@@ -424,6 +709,7 @@ static void cqhci_prep_task_desc(struct mmc_request *mrq,
 		CQHCI_INT(intr) |
 		CQHCI_ACT(0x5) |
 		CQHCI_FORCED_PROG(!!(req_flags & MMC_DATA_FORCED_PRG)) |
+		CQHCI_CONTEXT(CQHCI_DATA_CONTEXT(req_flags)) |
 		CQHCI_DATA_TAG(!!(req_flags & MMC_DATA_DAT_TAG)) |
 		CQHCI_DATA_DIR(!!(req_flags & MMC_DATA_READ)) |
 		CQHCI_PRIORITY(!!(req_flags & MMC_DATA_PRIO)) |
@@ -478,6 +764,274 @@ static void cqhci_set_tran_desc(u8 *desc, dma_addr_t addr, int len, bool end,
 	}
 }
 
+/* Pool buffers are chained in segments short of the 16-bit DAT_LENGTH */
+#define CQHCI_POOL_SEG_SIZE	SZ_32K
+
+static inline dma_addr_t cqhci_pool_dma(struct cqhci_host *cq_host, int tag)
+{
+	return sg_dma_address(&cq_host->pool_sg[tag]);
+}
+
+static unsigned int cqhci_pool_seg_len(struct cqhci_host *cq_host, int seg)
+{
+	return min_t(unsigned int, CQHCI_POOL_SEG_SIZE,
+		     cq_host->pool_buf_size - seg * CQHCI_POOL_SEG_SIZE);
+}
+
+static void cqhci_pool_set_seg(struct cqhci_host *cq_host, int tag, int seg,
+			       unsigned int len, bool end)
+{
+	u8 *desc = get_trans_desc(cq_host, tag) + seg * cq_host->trans_desc_len;
+
+	cqhci_set_tran_desc(desc, cqhci_pool_dma(cq_host, tag) +
+			    seg * CQHCI_POOL_SEG_SIZE, len, end,
+			    cq_host->dma64);
+}
+
+/* Describe the whole pool buffer of @tag in its transfer descriptors */
+static void cqhci_pool_build(struct cqhci_host *cq_host, u8 tag)
+{
+	int segs = DIV_ROUND_UP(cq_host->pool_buf_size, CQHCI_POOL_SEG_SIZE);
+	int i;
+
+	for (i = 0; i < segs; i++)
+		cqhci_pool_set_seg(cq_host, tag, i,
+				   cqhci_pool_seg_len(cq_host, i),
+				   i == segs - 1);
+
+	cq_host->slot[tag].pool_end = segs - 1;
+}
+
+static bool cqhci_pool_data(struct cqhci_host *cq_host, struct mmc_data *data)
+{
+	return cq_host->pool_sg && data->sg >= cq_host->pool_sg &&
+	       data->sg < cq_host->pool_sg + cq_host->mmc->cqe_qdepth;
+}
+
+/*
+ * The descriptors of a pool slot already map its buffer, so a request only
+ * moves the END mark to the segment holding its last byte: at most two
+ * descriptor writes, no DMA mapping, and cache maintenance over the bytes
+ * the request moves rather than the whole buffer.
+ */
+static int cqhci_pool_prep_tran_desc(struct mmc_request *mrq,
+				     struct cqhci_host *cq_host, int tag)
+{
+	struct mmc_data *data = mrq->data;
+	struct cqhci_slot *slot = &cq_host->slot[tag];
+	unsigned int len = data->blksz * data->blocks;
+	int end;
+
+	if (data->sg != &cq_host->pool_sg[tag] || data->sg_len != 1 ||
+	    !len || len > cq_host->pool_buf_size)
+		return -EINVAL;
+
+	if (slot->pool_end < 0)
+		cqhci_pool_build(cq_host, tag);
+
+	end = (len - 1) / CQHCI_POOL_SEG_SIZE;
+
+	if (slot->pool_end != end)
+		cqhci_pool_set_seg(cq_host, tag, slot->pool_end,
+				   cqhci_pool_seg_len(cq_host, slot->pool_end),
+				   false);
+	cqhci_pool_set_seg(cq_host, tag, end, len - end * CQHCI_POOL_SEG_SIZE,
+			   true);
+	slot->pool_end = end;
+
+	dma_sync_single_for_device(mmc_dev(cq_host->mmc),
+				   cqhci_pool_dma(cq_host, tag), len,
+				   DMA_BIDIRECTIONAL);
+
+	return 0;
+}
+
+static void cqhci_pool_release(struct device *dev, void **bufs,
+			       struct scatterlist *sg, unsigned int slots,
+			       unsigned int size)
+{
+	int i;
+
+	for (i = 0; bufs && sg && i < slots && bufs[i]; i++) {
+		if (sg_dma_address(&sg[i]))
+			dma_unmap_single(dev, sg_dma_address(&sg[i]), size,
+					 DMA_BIDIRECTIONAL);
+		kfree(bufs[i]);
+	}
+
+	kfree(sg);
+	kfree(bufs);
+}
+
+static void cqhci_pool_free(struct cqhci_host *cq_host)
+{
+	struct mmc_host *mmc = cq_host->mmc;
+
+	if (!cq_host->pool_bufs)
+		return;
+
+	cqhci_pool_release(mmc_dev(mmc), cq_host->pool_bufs, cq_host->pool_sg,
+			   mmc->cqe_qdepth, cq_host->pool_buf_size);
+
+	cq_host->pool_bufs = NULL;
+	cq_host->pool_sg = NULL;
+	cq_host->pool_buf_size = 0;
+}
+
+static int cqhci_pool_alloc(struct mmc_host *mmc, unsigned int size,
+			    void ***pbufs, struct scatterlist **psg)
+{
+	unsigned int slots = mmc->cqe_qdepth;
+	struct scatterlist *sg;
+	void **bufs;
+	dma_addr_t dma;
+	int i;
+
+	bufs = kcalloc(slots, sizeof(*bufs), GFP_KERNEL);
+	sg = kcalloc(slots, sizeof(*sg), GFP_KERNEL);
+	if (!bufs || !sg)
+		goto out_nomem;
+
+	for (i = 0; i < slots; i++) {
+		bufs[i] = kmalloc(size, GFP_KERNEL);
+		if (!bufs[i])
+			goto out_nomem;
+
+		sg_init_one(&sg[i], bufs[i], size);
+		dma = dma_map_single(mmc_dev(mmc), bufs[i], size,
+				     DMA_BIDIRECTIONAL);
+		if (dma_mapping_error(mmc_dev(mmc), dma))
+			goto out_nomem;
+		sg_dma_address(&sg[i]) = dma;
+	}
+
+	*pbufs = bufs;
+	*psg = sg;
+
+	return 0;
+
+out_nomem:
+	cqhci_pool_release(mmc_dev(mmc), bufs, sg, slots, size);
+	return -ENOMEM;
+}
+
+/*
+ * Switch to the buffers in @bufs, or to none, with the engine idle. The
+ * transfer descriptors only exist while enabled, setup_trans_desc() builds
+ * them otherwise.
+ */
+static void cqhci_pool_install(struct cqhci_host *cq_host, void **bufs,
+			       struct scatterlist *sg, unsigned int size)
+{
+	int i;
+
+	cq_host->pool_bufs = bufs;
+	cq_host->pool_sg = sg;
+	cq_host->pool_buf_size = size;
+	cq_host->pool_reqs = 0;
+
+	if (!cq_host->trans_desc_base)
+		return;
+
+	for (i = 0; i < cq_host->mmc->cqe_qdepth; i++) {
+		if (bufs)
+			cqhci_pool_build(cq_host, i);
+		else
+			cq_host->slot[i].pool_end = -1;
+	}
+}
+
+/* Buffers only exist while CQE is enabled, see mmc_cqe_pool_init() */
+static void cqhci_pool_enable(struct cqhci_host *cq_host)
+{
+	struct mmc_host *mmc = cq_host->mmc;
+	struct scatterlist *sg;
+	void **bufs;
+
+	if (!cq_host->pool_size)
+		return;
+
+	if (cqhci_pool_alloc(mmc, cq_host->pool_size, &bufs, &sg)) {
+		pr_warn("%s: cqhci: no memory for the data pool\n",
+			mmc_hostname(mmc));
+		return;
+	}
+
+	cqhci_pool_install(cq_host, bufs, sg, cq_host->pool_size);
+}
+
+/*
+ * See mmc_cqe_pool_init(). Buffers of @size are allocated and mapped while
+ * CQE is enabled, and freed by cqhci_disable(): @size is kept, so they come
+ * back with the next enable. Returns -EBUSY with tasks queued.
+ */
+static int cqhci_pool_init(struct mmc_host *mmc, unsigned int size)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	struct scatterlist *sg = NULL, *old_sg;
+	void **bufs = NULL, **old_bufs;
+	unsigned int old_size;
+	unsigned long flags;
+	int err;
+
+	/* keep every buffer, and so every descriptor address, block aligned */
+	size = ALIGN(size, 512);
+	if (size > mmc->max_req_size ||
+	    size > CQHCI_POOL_SEG_SIZE * mmc->max_segs)
+		return -EINVAL;
+
+	if (cq_host->enabled && size) {
+		err = cqhci_pool_alloc(mmc, size, &bufs, &sg);
+		if (err)
+			return err;
+	}
+
+	spin_lock_irqsave(&cq_host->lock, flags);
+
+	if (cq_host->qcnt) {
+		spin_unlock_irqrestore(&cq_host->lock, flags);
+		cqhci_pool_release(mmc_dev(mmc), bufs, sg, mmc->cqe_qdepth,
+				   size);
+		return -EBUSY;
+	}
+
+	old_bufs = cq_host->pool_bufs;
+	old_sg = cq_host->pool_sg;
+	old_size = cq_host->pool_buf_size;
+
+	cq_host->pool_size = size;
+	cqhci_pool_install(cq_host, bufs, sg, bufs ? size : 0);
+
+	spin_unlock_irqrestore(&cq_host->lock, flags);
+
+	cqhci_pool_release(mmc_dev(mmc), old_bufs, old_sg, mmc->cqe_qdepth,
+			   old_size);
+
+	return 0;
+}
+
+/* See mmc_cqe_pool_attach() */
+static void *cqhci_pool_attach(struct mmc_host *mmc, struct mmc_data *data,
+			       int tag)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	unsigned int len = data->blksz * data->blocks;
+	struct scatterlist *sg;
+
+	if (!cq_host->pool_bufs || tag < 0 || tag >= mmc->cqe_qdepth ||
+	    len > cq_host->pool_buf_size)
+		return NULL;
+
+	sg = &cq_host->pool_sg[tag];
+	sg->length = len;
+	sg_dma_len(sg) = len;
+
+	data->sg = sg;
+	data->sg_len = 1;
+
+	return cq_host->pool_bufs[tag];
+}
+
 static int cqhci_prep_tran_desc(struct mmc_request *mrq,
 			       struct cqhci_host *cq_host, int tag)
 {
@@ -497,6 +1051,7 @@ static int cqhci_prep_tran_desc(struct mmc_request *mrq,
 	}
 
 	desc = get_trans_desc(cq_host, tag);
+	cq_host->slot[tag].pool_end = -1;
 
 	for_each_sg(data->sg, sg, sg_count, i) {
 		addr = sg_dma_address(sg);
@@ -553,20 +1108,112 @@ static void cqhci_prep_dcmd_desc(struct mmc_host *mmc,
 
 }
 
+static inline int cqhci_tag(struct mmc_request *mrq)
+{
+	return mrq->cmd ? DCMD_SLOT : mrq->tag;
+}
+
+/* Bucket b counts [2^(b-1), 2^b) us, the last one everything longer */
+static void cqhci_hist_add(unsigned int *hist, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+
+	hist[min_t(int, fls64(us), CQHCI_HIST_BUCKETS - 1)] += 1;
+}
+
 static void cqhci_post_req(struct mmc_host *host, struct mmc_request *mrq)
 {
+	struct cqhci_host *cq_host = host->cqe_private;
+	struct cqhci_slot *slot = &cq_host->slot[cqhci_tag(mrq)];
 	struct mmc_data *data = mrq->data;
 
-	if (data) {
+	if (data && cqhci_pool_data(cq_host, data)) {
+		dma_sync_single_for_cpu(mmc_dev(host),
+					sg_dma_address(data->sg),
+					data->blksz * data->blocks,
+					DMA_BIDIRECTIONAL);
+	} else if (data) {
 		dma_unmap_sg(mmc_dev(host), data->sg, data->sg_len,
 			     (data->flags & MMC_DATA_READ) ?
 			     DMA_FROM_DEVICE : DMA_TO_DEVICE);
 	}
+
+	/* Unlocked: the caller owns the tag, and a lost count is harmless */
+	if (slot->done_time) {
+		cqhci_hist_add(cq_host->overhead_hist,
+			       ktime_to_ns(ktime_sub(ktime_get(),
+						     slot->done_time)));
+		slot->done_time = 0;
+	}
 }
 
-static inline int cqhci_tag(struct mmc_request *mrq)
+/*
+ * Charge the time since the last change to the current queue depth, then
+ * move to @qcnt. Called with cq_host->lock held, or with the engine halted.
+ */
+static void cqhci_set_qcnt(struct cqhci_host *cq_host, int qcnt, ktime_t now)
 {
-	return mrq->cmd ? DCMD_SLOT : mrq->tag;
+	if (cq_host->qcnt_stamp)
+		cq_host->qcnt_ns[cq_host->qcnt] +=
+			ktime_to_ns(ktime_sub(now, cq_host->qcnt_stamp));
+	cq_host->qcnt_stamp = now;
+	cq_host->qcnt = qcnt;
+}
+
+/*
+ * Descriptors live in coherent memory, make sure the engine sees them
+ * before it is told to fetch them. Called with cq_host->lock held.
+ */
+static void cqhci_ring_doorbell(struct cqhci_host *cq_host, u32 mask,
+				ktime_t now)
+{
+	unsigned long pending = mask;
+	int tag;
+
+	for_each_set_bit(tag, &pending, NUM_SLOTS) {
+		cq_host->slot[tag].issue_time = now;
+		trace_cqhci_task_issue(cq_host->mmc, tag, cq_host->qcnt);
+	}
+
+	wmb();
+	cqhci_writel(cq_host, mask, CQHCI_TDBR);
+
+#ifdef CONFIG_MMC_DEBUG
+	/* A task can finish before the read-back, so this is a hint only */
+	if ((cqhci_readl(cq_host, CQHCI_TDBR) & mask) != mask)
+		pr_debug("%s: cqhci: doorbell not set for 0x%08x\n",
+			 mmc_hostname(cq_host->mmc), mask);
+#endif
+}
+
+/*
+ * Tasks queued until cqhci_commit() get their descriptors written straight
+ * away, but the doorbell is only rung once, for all of them, by
+ * cqhci_commit(). See mmc_cqe_plug().
+ */
+static void cqhci_plug(struct mmc_host *mmc)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cq_host->lock, flags);
+	cq_host->plugged = true;
+	spin_unlock_irqrestore(&cq_host->lock, flags);
+}
+
+static void cqhci_commit(struct mmc_host *mmc)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cq_host->lock, flags);
+	cq_host->plugged = false;
+	/* During recovery the unrung tasks are failed back with the rest */
+	if (cq_host->pending_db && !cq_host->recovery_halt)
+		cqhci_ring_doorbell(cq_host, cq_host->pending_db,
+				    ktime_get());
+	cq_host->pending_db = 0;
+	spin_unlock_irqrestore(&cq_host->lock, flags);
 }
 
 static int cqhci_request(struct mmc_host *mmc, struct mmc_request *mrq)
@@ -577,12 +1224,20 @@ static int cqhci_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	int tag = cqhci_tag(mrq);
 	struct cqhci_host *cq_host = mmc->cqe_private;
 	unsigned long flags;
+	ktime_t now;
 
 	if (!cq_host->enabled) {
 		pr_err("%s: cqhci: not enabled\n", mmc_hostname(mmc));
 		return -EINVAL;
 	}
 
+	/*
+	 * Nobody calls mmc_cqe_poll() for a direct command, and without the
+	 * TCC interrupt it would never complete: have it sent the usual way.
+	 */
+	if (mrq->cmd && READ_ONCE(cq_host->poll_mode))
+		return -EOPNOTSUPP;
+
 	/* First request after resume has to re-enable */
 	if (!cq_host->activated)
 		__cqhci_enable(cq_host);
@@ -601,9 +1256,13 @@ static int cqhci_request(struct mmc_host *mmc, struct mmc_request *mrq)
 
 	if (mrq->data) {
 		task_desc = (__le64 __force *)get_desc(cq_host, tag);
-		cqhci_prep_task_desc(mrq, &data, 1);
+		cqhci_prep_task_desc(mrq, &data,
+				     cqhci_task_intr(cq_host, mrq));
 		*task_desc = cpu_to_le64(data);
-		err = cqhci_prep_tran_desc(mrq, cq_host, tag);
+		if (cqhci_pool_data(cq_host, mrq->data))
+			err = cqhci_pool_prep_tran_desc(mrq, cq_host, tag);
+		else
+			err = cqhci_prep_tran_desc(mrq, cq_host, tag);
 		if (err) {
 			pr_err("%s: cqhci: failed to setup tx desc: %d\n",
 			       mmc_hostname(mmc), err);
@@ -622,13 +1281,24 @@ static int cqhci_request(struct mmc_host *mmc, struct mmc_request *mrq)
 
 	cq_host->slot[tag].mrq = mrq;
 	cq_host->slot[tag].flags = 0;
+	cq_host->slot[tag].done_time = 0;
 
-	cq_host->qcnt += 1;
+	now = ktime_get();
+	cqhci_set_qcnt(cq_host, cq_host->qcnt + 1, now);
+	if (mrq->data && cqhci_pool_data(cq_host, mrq->data))
+		cq_host->pool_reqs += 1;
 
-	cqhci_writel(cq_host, 1 << tag, CQHCI_TDBR);
-	if (!(cqhci_readl(cq_host, CQHCI_TDBR) & (1 << tag)))
-		pr_debug("%s: cqhci: doorbell not set for tag %d\n",
-			 mmc_hostname(mmc), tag);
+	/*
+	 * Somebody waits for a DCMD straight away, so it takes the batch
+	 * queued so far along with it rather than wait for the commit.
+	 */
+	if (cq_host->plugged && mrq->data) {
+		cq_host->pending_db |= 1 << tag;
+	} else {
+		cqhci_ring_doorbell(cq_host, cq_host->pending_db | 1 << tag,
+				    now);
+		cq_host->pending_db = 0;
+	}
 out_unlock:
 	spin_unlock_irqrestore(&cq_host->lock, flags);
 
@@ -671,6 +1341,8 @@ static void cqhci_error_irq(struct mmc_host *mmc, u32 status, int cmd_error,
 {
 	struct cqhci_host *cq_host = mmc->cqe_private;
 	struct cqhci_slot *slot;
+	int fault_tag = -1;
+	bool cmd_fault = false;
 	u32 terri;
 	int tag;
 
@@ -698,6 +1370,8 @@ static void cqhci_error_irq(struct mmc_host *mmc, u32 status, int cmd_error,
 		if (slot->mrq) {
 			slot->flags = cqhci_error_flags(cmd_error, data_error);
 			cqhci_recovery_needed(mmc, slot->mrq, true);
+			fault_tag = tag;
+			cmd_fault = true;
 		}
 	}
 
@@ -707,9 +1381,16 @@ static void cqhci_error_irq(struct mmc_host *mmc, u32 status, int cmd_error,
 		if (slot->mrq) {
 			slot->flags = cqhci_error_flags(data_error, cmd_error);
 			cqhci_recovery_needed(mmc, slot->mrq, true);
+			/* two tasks at fault is a job for the full recovery */
+			fault_tag = fault_tag < 0 || fault_tag == tag ? tag : -1;
+			cmd_fault = false;
 		}
 	}
 
+	cq_host->recovery_tag = fault_tag;
+	cq_host->recovery_cmd_err = cmd_fault;
+	cq_host->recovery_injected = false;
+
 	if (!cq_host->recovery_halt) {
 		/*
 		 * The only way to guarantee forward progress is to mark at
@@ -729,6 +1410,23 @@ out_unlock:
 	spin_unlock(&cq_host->lock);
 }
 
+/* Doorbell to TCN is the device's service time, queueing included */
+static void cqhci_account_done(struct cqhci_host *cq_host, unsigned int tag)
+{
+	struct cqhci_slot *slot = &cq_host->slot[tag];
+	ktime_t now = ktime_get();
+	u64 ns = ktime_to_ns(ktime_sub(now, slot->issue_time));
+
+	cqhci_hist_add(cq_host->service_hist, ns);
+	if (ns > cq_host->service_max_ns)
+		cq_host->service_max_ns = ns;
+
+	slot->done_time = now;
+	cqhci_set_qcnt(cq_host, cq_host->qcnt - 1, now);
+
+	trace_cqhci_task_done(cq_host->mmc, tag, ns, cq_host->qcnt);
+}
+
 static void cqhci_finish_mrq(struct mmc_host *mmc, unsigned int tag)
 {
 	struct cqhci_host *cq_host = mmc->cqe_private;
@@ -750,7 +1448,11 @@ static void cqhci_finish_mrq(struct mmc_host *mmc, unsigned int tag)
 
 	slot->mrq = NULL;
 
-	cq_host->qcnt -= 1;
+	cqhci_account_done(cq_host, tag);
+
+	/* The response of a direct command is latched in CRDCT */
+	if (!mrq->data)
+		mrq->cmd->resp[0] = cqhci_readl(cq_host, CQHCI_CRDCT);
 
 	data = mrq->data;
 	if (data) {
@@ -763,11 +1465,73 @@ static void cqhci_finish_mrq(struct mmc_host *mmc, unsigned int tag)
 	mmc_cqe_request_done(mmc, mrq);
 }
 
+#ifdef CONFIG_FAIL_MMC_REQUEST
+/*
+ * The one fail_mmc_request injection point for CQE: fail a task the card
+ * completed as if TERRI had reported a data CRC error on it, so that the
+ * task recovery and its statistics can be exercised. The card has nothing
+ * left to stop for it.
+ */
+static bool cqhci_inject_error(struct mmc_host *mmc, unsigned int tag)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	struct cqhci_slot *slot = &cq_host->slot[tag];
+	struct mmc_data *data = slot->mrq ? slot->mrq->data : NULL;
+
+	if (!data || cq_host->recovery_halt ||
+	    !should_fail(&mmc->fail_mmc_request, data->blksz * data->blocks))
+		return false;
+
+	slot->flags = CQHCI_HOST_CRC;
+	cq_host->recovery_tag = tag;
+	cq_host->recovery_cmd_err = false;
+	cq_host->recovery_injected = true;
+	cqhci_recovery_needed(mmc, slot->mrq, true);
+
+	return true;
+}
+#else
+static inline bool cqhci_inject_error(struct mmc_host *mmc, unsigned int tag)
+{
+	return false;
+}
+#endif
+
+/* Complete the tasks reported in TCN. Called with cq_host->lock held. */
+static unsigned int cqhci_reap(struct mmc_host *mmc)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	unsigned long tag = 0, comp_status;
+
+	comp_status = cqhci_readl(cq_host, CQHCI_TCN);
+	if (!comp_status)
+		goto out;
+
+	cqhci_writel(cq_host, comp_status, CQHCI_TCN);
+	pr_debug("%s: cqhci: TCN: 0x%08lx\n",
+		 mmc_hostname(mmc), comp_status);
+
+	for_each_set_bit(tag, &comp_status, cq_host->num_slots) {
+		/* complete the corresponding mrq */
+		pr_debug("%s: cqhci: completing tag %lu\n",
+			 mmc_hostname(mmc), tag);
+		if (!cqhci_inject_error(mmc, tag))
+			cqhci_finish_mrq(mmc, tag);
+	}
+
+	if (cq_host->waiting_for_idle && !cq_host->qcnt) {
+		cq_host->waiting_for_idle = false;
+		wake_up(&cq_host->wait_queue);
+	}
+out:
+	return hweight_long(comp_status);
+}
+
 irqreturn_t cqhci_irq(struct mmc_host *mmc, u32 intmask, int cmd_error,
 		      int data_error)
 {
 	u32 status;
-	unsigned long tag = 0, comp_status;
+	unsigned int done;
 	struct cqhci_host *cq_host = mmc->cqe_private;
 
 	status = cqhci_readl(cq_host, CQHCI_IS);
@@ -780,24 +1544,11 @@ irqreturn_t cqhci_irq(struct mmc_host *mmc, u32 intmask, int cmd_error,
 
 	if (status & CQHCI_IS_TCC) {
 		/* read TCN and complete the request */
-		comp_status = cqhci_readl(cq_host, CQHCI_TCN);
-		cqhci_writel(cq_host, comp_status, CQHCI_TCN);
-		pr_debug("%s: cqhci: TCN: 0x%08lx\n",
-			 mmc_hostname(mmc), comp_status);
-
 		spin_lock(&cq_host->lock);
 
-		for_each_set_bit(tag, &comp_status, cq_host->num_slots) {
-			/* complete the corresponding mrq */
-			pr_debug("%s: cqhci: completing tag %lu\n",
-				 mmc_hostname(mmc), tag);
-			cqhci_finish_mrq(mmc, tag);
-		}
-
-		if (cq_host->waiting_for_idle && !cq_host->qcnt) {
-			cq_host->waiting_for_idle = false;
-			wake_up(&cq_host->wait_queue);
-		}
+		done = cqhci_reap(mmc);
+		cq_host->irqs++;
+		cq_host->irq_tasks[done]++;
 
 		spin_unlock(&cq_host->lock);
 	}
@@ -812,6 +1563,29 @@ irqreturn_t cqhci_irq(struct mmc_host *mmc, u32 intmask, int cmd_error,
 }
 EXPORT_SYMBOL(cqhci_irq);
 
+/*
+ * Completes whatever TCN reports, from the calling context and without
+ * waiting for the interrupt, in either mode. See mmc_cqe_poll().
+ */
+static int cqhci_poll(struct mmc_host *mmc)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	unsigned long flags;
+	unsigned int done;
+
+	spin_lock_irqsave(&cq_host->lock, flags);
+
+	/* Ack first, a task finishing after the TCN read latches it again */
+	cqhci_writel(cq_host, CQHCI_IS_TCC, CQHCI_IS);
+	done = cqhci_reap(mmc);
+	cq_host->polls++;
+	cq_host->polled_tasks += done;
+
+	spin_unlock_irqrestore(&cq_host->lock, flags);
+
+	return done;
+}
+
 static bool cqhci_is_idle(struct cqhci_host *cq_host, int *ret)
 {
 	unsigned long flags;
@@ -831,6 +1605,18 @@ static int cqhci_wait_for_idle(struct mmc_host *mmc)
 	struct cqhci_host *cq_host = mmc->cqe_private;
 	int ret;
 
+	/* Nothing unrung would ever complete */
+	if (cq_host->plugged)
+		cqhci_commit(mmc);
+
+	/* No TCC interrupt is coming to wake us, reap every jiffy instead */
+	while (cq_host->poll_mode) {
+		cqhci_poll(mmc);
+		if (wait_event_timeout(cq_host->wait_queue,
+				       cqhci_is_idle(cq_host, &ret), 1))
+			return ret;
+	}
+
 	wait_event(cq_host->wait_queue, cqhci_is_idle(cq_host, &ret));
 
 	return ret;
@@ -845,6 +1631,10 @@ static bool cqhci_timeout(struct mmc_host *mmc, struct mmc_request *mrq,
 	unsigned long flags;
 	bool timed_out;
 
+	/* It may well have finished with nobody polling for it */
+	if (cq_host->poll_mode)
+		cqhci_poll(mmc);
+
 	spin_lock_irqsave(&cq_host->lock, flags);
 	timed_out = slot->mrq == mrq;
 	if (timed_out) {
@@ -927,30 +1717,6 @@ static bool cqhci_halt(struct mmc_host *mmc, unsigned int timeout)
 	return ret;
 }
 
-/*
- * After halting we expect to be able to use the command line. We interpret the
- * failure to halt to mean the data lines might still be in use (and the upper
- * layers will need to send a STOP command), so we set the timeout based on a
- * generous command timeout.
- */
-#define CQHCI_START_HALT_TIMEOUT	5
-
-static void cqhci_recovery_start(struct mmc_host *mmc)
-{
-	struct cqhci_host *cq_host = mmc->cqe_private;
-
-	pr_debug("%s: cqhci: %s\n", mmc_hostname(mmc), __func__);
-
-	WARN_ON(!cq_host->recovery_halt);
-
-	cqhci_halt(mmc, CQHCI_START_HALT_TIMEOUT);
-
-	if (cq_host->ops->disable)
-		cq_host->ops->disable(mmc, true);
-
-	mmc->cqe_on = false;
-}
-
 static int cqhci_error_from_flags(unsigned int flags)
 {
 	if (!flags)
@@ -977,7 +1743,7 @@ static void cqhci_recover_mrq(struct cqhci_host *cq_host, unsigned int tag)
 
 	slot->mrq = NULL;
 
-	cq_host->qcnt -= 1;
+	cqhci_set_qcnt(cq_host, cq_host->qcnt - 1, ktime_get());
 
 	data = mrq->data;
 	if (data) {
@@ -1008,6 +1774,157 @@ static void cqhci_recover_mrqs(struct cqhci_host *cq_host)
 /* CQHCI could be expected to clear it's internal state pretty quickly */
 #define CQHCI_CLEAR_TIMEOUT		20
 
+static bool cqhci_task_cleared(struct cqhci_host *cq_host, int tag)
+{
+	return !(cqhci_readl(cq_host, CQHCI_TCLR) & BIT(tag));
+}
+
+static bool cqhci_clear_task(struct mmc_host *mmc, int tag,
+			     unsigned int timeout)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	bool ret;
+
+	cqhci_set_irqs(cq_host, CQHCI_IS_TCL);
+
+	cqhci_writel(cq_host, BIT(tag), CQHCI_TCLR);
+
+	wait_event_timeout(cq_host->wait_queue,
+			   cqhci_task_cleared(cq_host, tag),
+			   msecs_to_jiffies(timeout) + 1);
+
+	cqhci_set_irqs(cq_host, 0);
+
+	ret = cqhci_task_cleared(cq_host, tag);
+
+	if (!ret)
+		pr_debug("%s: cqhci: Failed to clear task %d\n",
+			 mmc_hostname(mmc), tag);
+
+	return ret;
+}
+
+static void cqhci_account_recovery(struct cqhci_host *cq_host, bool targeted)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), cq_host->recovery_stamp));
+	int i = targeted ? 0 : 1;
+
+	cq_host->recoveries[i]++;
+	cq_host->recovery_ns[i] += ns;
+	cq_host->recovery_max_ns[i] = max(cq_host->recovery_max_ns[i], ns);
+}
+
+/*
+ * Targeted recovery: TERRI pinned the error on a single task and nothing
+ * else has gone wrong since, so the core stops the card working on that
+ * task, and only its slot is cleared with TCLR. Called with the engine
+ * halted. Returns the tag, or -EINVAL when the full clear-all recovery is
+ * needed instead.
+ */
+static int cqhci_recovery_task(struct mmc_host *mmc, unsigned int *flags)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	int tag = cq_host->recovery_tag;
+	int i;
+
+	if (!cq_host->targeted_recovery || tag < 0 || !cq_host->slot[tag].mrq)
+		return -EINVAL;
+
+	for (i = 0; i < cq_host->num_slots; i++) {
+		unsigned int err = cq_host->slot[i].flags & CQHCI_SLOT_ERRORS;
+
+		/* a timeout leaves the state of the lines unknown */
+		if (cq_host->slot[i].mrq && err && (i != tag ||
+		    (err & (CQHCI_EXTERNAL_TIMEOUT | CQHCI_HOST_TIMEOUT))))
+			return -EINVAL;
+	}
+
+	*flags = 0;
+	if (tag == cq_host->dcmd_slot || cq_host->recovery_injected)
+		*flags |= MMC_CQE_TASK_IDLE;
+	else if (cq_host->recovery_cmd_err)
+		*flags |= MMC_CQE_TASK_QUEUED;
+
+	return tag;
+}
+
+/* Second half of a targeted recovery, the card has let go of @tag */
+static int cqhci_recovery_resume(struct mmc_host *mmc, int tag)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+	unsigned long flags;
+	int i;
+
+	if (!cqhci_clear_task(mmc, tag, CQHCI_CLEAR_TIMEOUT))
+		return -ETIMEDOUT;
+
+	cqhci_recover_mrq(cq_host, tag);
+
+	spin_lock_irqsave(&cq_host->lock, flags);
+	cq_host->recovery_halt = false;
+	cq_host->recovery_tag = -1;
+	cq_host->recovery_injected = false;
+	/* deliver what completed while we were halted */
+	for (i = 0; i < cq_host->num_slots; i++) {
+		if (!(cq_host->slot[i].flags & CQHCI_COMPLETED))
+			continue;
+		cq_host->slot[i].flags &= ~CQHCI_COMPLETED;
+		if (cq_host->slot[i].mrq)
+			cqhci_finish_mrq(mmc, i);
+	}
+	spin_unlock_irqrestore(&cq_host->lock, flags);
+
+	cqhci_writel(cq_host, CQHCI_IS_HAC | CQHCI_IS_TCL, CQHCI_IS);
+	cqhci_set_irqs(cq_host, CQHCI_IS_MASK);
+
+	/* and resume the rest of the queue */
+	cqhci_writel(cq_host, 0, CQHCI_CTL);
+	mmc->cqe_on = true;
+	if (cq_host->ops->enable)
+		cq_host->ops->enable(mmc);
+
+	cqhci_account_recovery(cq_host, true);
+
+	pr_debug("%s: cqhci: recovered tag %d alone\n", mmc_hostname(mmc), tag);
+
+	return 0;
+}
+
+/*
+ * After halting we expect to be able to use the command line. We interpret the
+ * failure to halt to mean the data lines might still be in use (and the upper
+ * layers will need to send a STOP command), so we set the timeout based on a
+ * generous command timeout.
+ */
+#define CQHCI_START_HALT_TIMEOUT	5
+
+/*
+ * Only halts: whether a single task can be recovered is up to
+ * cqhci_recovery_task(), otherwise cqhci_recovery_finish() clears them all.
+ */
+static void cqhci_recovery_start(struct mmc_host *mmc)
+{
+	struct cqhci_host *cq_host = mmc->cqe_private;
+
+	pr_debug("%s: cqhci: %s\n", mmc_hostname(mmc), __func__);
+
+	WARN_ON(!cq_host->recovery_halt);
+
+	cq_host->recovery_stamp = ktime_get();
+
+	/* tasks cannot be cleared one by one from an engine that runs on */
+	if (!cqhci_halt(mmc, CQHCI_START_HALT_TIMEOUT) &&
+	    cq_host->recovery_tag >= 0) {
+		cq_host->recovery_fallbacks++;
+		cq_host->recovery_tag = -1;
+	}
+
+	if (cq_host->ops->disable)
+		cq_host->ops->disable(mmc, true);
+
+	mmc->cqe_on = false;
+}
+
 static void cqhci_recovery_finish(struct mmc_host *mmc)
 {
 	struct cqhci_host *cq_host = mmc->cqe_private;
@@ -1019,6 +1936,10 @@ static void cqhci_recovery_finish(struct mmc_host *mmc)
 
 	WARN_ON(!cq_host->recovery_halt);
 
+	/* a single task at fault, but targeted recovery did not manage */
+	if (cq_host->recovery_tag >= 0)
+		cq_host->recovery_fallbacks++;
+
 	ok = cqhci_halt(mmc, CQHCI_FINISH_HALT_TIMEOUT);
 
 	if (!cqhci_clear_all_tasks(mmc, CQHCI_CLEAR_TIMEOUT))
@@ -1049,7 +1970,10 @@ static void cqhci_recovery_finish(struct mmc_host *mmc)
 	WARN_ON(cq_host->qcnt);
 
 	spin_lock_irqsave(&cq_host->lock, flags);
-	cq_host->qcnt = 0;
+	cqhci_set_qcnt(cq_host, 0, ktime_get());
+	cq_host->pending_db = 0;
+	cq_host->recovery_tag = -1;
+	cq_host->recovery_injected = false;
 	cq_host->recovery_halt = false;
 	mmc->cqe_on = false;
 	spin_unlock_irqrestore(&cq_host->lock, flags);
@@ -1061,6 +1985,8 @@ static void cqhci_recovery_finish(struct mmc_host *mmc)
 
 	cqhci_set_irqs(cq_host, CQHCI_IS_MASK);
 
+	cqhci_account_recovery(cq_host, false);
+
 	pr_debug("%s: cqhci: recovery done\n", mmc_hostname(mmc));
 }
 
@@ -1076,6 +2002,17 @@ static const struct mmc_cqe_ops cqhci_cqe_ops = {
 	.cqe_recovery_finish = cqhci_recovery_finish,
 };
 
+static const struct mmc_cqe_ext_ops cqhci_cqe_ext_ops = {
+	.cqe_plug = cqhci_plug,
+	.cqe_commit = cqhci_commit,
+	.cqe_set_poll = cqhci_set_poll,
+	.cqe_poll = cqhci_poll,
+	.cqe_pool_init = cqhci_pool_init,
+	.cqe_pool_attach = cqhci_pool_attach,
+	.cqe_recovery_task = cqhci_recovery_task,
+	.cqe_recovery_resume = cqhci_recovery_resume,
+};
+
 struct cqhci_host *cqhci_pltfm_init(struct platform_device *pdev)
 {
 	struct cqhci_host *cq_host;
@@ -1130,6 +2067,7 @@ int cqhci_init(struct cqhci_host *cq_host, struct mmc_host *mmc,
 	cq_host->dcmd_slot = DCMD_SLOT;
 
 	mmc->cqe_ops = &cqhci_cqe_ops;
+	mmc_cqe_set_ext_ops(mmc, &cqhci_cqe_ext_ops);
 
 	mmc->cqe_qdepth = NUM_SLOTS;
 	if (mmc->caps2 & MMC_CAP2_CQE_DCMD)
@@ -1144,6 +2082,13 @@ int cqhci_init(struct cqhci_host *cq_host, struct mmc_host *mmc,
 
 	spin_lock_init(&cq_host->lock);
 
+	/* coalescing stays off until ic_count is set */
+	cq_host->ic_timeout = CQHCI_IC_DEFAULT_ICTOVAL;
+	cq_host->ic_adaptive = true;
+	cq_host->ic_adapt_depth = CQHCI_IC_DEFAULT_ADAPT_DEPTH;
+	cq_host->targeted_recovery = true;
+	cq_host->recovery_tag = -1;
+
 	init_completion(&cq_host->halt_comp);
 	init_waitqueue_head(&cq_host->wait_queue);
 
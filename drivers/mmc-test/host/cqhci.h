@@ -19,6 +19,7 @@
 #include <linux/completion.h>
 #include <linux/wait.h>
 #include <linux/irqreturn.h>
+#include <linux/ktime.h>
 #include <asm/io.h>
 
 /* registers */
@@ -117,6 +118,10 @@
 #define CQHCI_INT_ALL			0xF
 #define CQHCI_IC_DEFAULT_ICCTH		31
 #define CQHCI_IC_DEFAULT_ICTOVAL	1
+#define CQHCI_IC_DEFAULT_ADAPT_DEPTH	4
+
+/* log2 latency histogram buckets, the last one open-ended at 16 ms */
+#define CQHCI_HIST_BUCKETS		16
 
 /* attribute fields */
 #define CQHCI_VALID(x)			(((x) & 1) << 0)
@@ -135,6 +140,9 @@
 #define CQHCI_BLK_COUNT(x)		(((x) & 0xFFFF) << 16)
 #define CQHCI_BLK_ADDR(x)		(((x) & 0xFFFFFFFF) << 32)
 
+/* context ID the core packs into mmc_data flags bits 16-19 */
+#define CQHCI_DATA_CONTEXT(flags)	(((flags) >> 16) & 0xF)
+
 /* direct command task descriptor fields */
 #define CQHCI_CMD_INDEX(x)		(((x) & 0x3F) << 16)
 #define CQHCI_CMD_TIMING(x)		(((x) & 1) << 22)
@@ -147,6 +155,9 @@
 
 struct cqhci_host_ops;
 struct mmc_host;
+struct dentry;
+struct mmc_data;
+struct scatterlist;
 struct cqhci_slot;
 
 struct cqhci_host {
@@ -177,6 +188,54 @@ struct cqhci_host {
 	bool activated;
 	bool waiting_for_idle;
 	bool recovery_halt;
+	bool plugged;
+
+	/* tasks queued while plugged, rung by cqhci_commit() */
+	u32 pending_db;
+
+	/* interrupt coalescing, see cqhci_set_ic() */
+	u32 ic_count;
+	u32 ic_timeout;
+	bool ic_adaptive;
+	u32 ic_adapt_depth;
+	unsigned int irqs;
+	/* TCC interrupts by the number of tasks they completed, 0-32 */
+	unsigned int irq_tasks[32 + 1];
+
+	/* completions reaped by cqhci_poll() rather than the interrupt */
+	bool poll_mode;
+	unsigned int polls;
+	u64 polled_tasks;
+
+	/* error recovery, see cqhci_recovery_task() */
+	bool targeted_recovery;
+	bool recovery_cmd_err;
+	bool recovery_injected;		/* by fail_mmc_request */
+	int recovery_tag;
+	ktime_t recovery_stamp;
+	/* [0] targeted, [1] full */
+	unsigned int recoveries[2];
+	u64 recovery_ns[2];
+	u64 recovery_max_ns[2];
+	unsigned int recovery_fallbacks;
+
+	/* pre-mapped data buffers, see mmc_cqe_pool_init() */
+	unsigned int pool_size;		/* requested, 0 = no pool */
+	void **pool_bufs;
+	struct scatterlist *pool_sg;
+	unsigned int pool_buf_size;
+	u64 pool_reqs;
+
+	/* telemetry, see cqhci_account_done() */
+	ktime_t qcnt_stamp;
+	/* time spent at each queue depth, 0-32 */
+	u64 qcnt_ns[32 + 1];
+	/* doorbell to TCN, and TCN to post_req, see cqhci_hist_add() */
+	unsigned int service_hist[CQHCI_HIST_BUCKETS];
+	unsigned int overhead_hist[CQHCI_HIST_BUCKETS];
+	u64 service_max_ns;
+
+	struct dentry *debugfs;
 
 	size_t desc_size;
 	size_t data_size;
@@ -1,10 +1,14 @@
 #include <linux/busfreq-imx.h>
+#include <linux/bitmap.h>
+#include <linux/debugfs.h>
 #include <linux/io.h>
 #include <linux/delay.h>
 #include <linux/err.h>
 #include <linux/clk.h>
 #include <linux/gpio.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/pm_qos.h>
 #include <linux/slab.h>
 #include <linux/mmc/host.h>
@@ -17,6 +21,8 @@
 #include <linux/pinctrl/consumer.h>
 #include <linux/platform_data/mmc-esdhc-imx.h>
 #include <linux/pm_runtime.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
 #include "sdhci-pltfm.h"
 #include "sdhci-esdhc.h"
 #include "cqhci.h"
@@ -61,6 +67,9 @@
 #define  ESDHC_TUNE_CTRL_STEP           1
 #define  ESDHC_TUNE_CTRL_MIN            0
 #define  ESDHC_TUNE_CTRL_MAX            ((1 << 7) - 1)
+#define  ESDHC_TUNE_CTRL_TAPS           (ESDHC_TUNE_CTRL_MAX + 1)
+#define  ESDHC_TUNE_CTRL_SHIFT          8
+#define  ESDHC_TUNE_CTRL_COARSE_STEP    8
 
 /* strobe dll register */
 #define ESDHC_STROBE_DLL_CTRL           0x70
@@ -107,6 +116,9 @@
 /* the address offset of CQHCI */
 #define ESDHC_CQHCI_ADDR_OFFSET         0x100
 
+/* drop the bus freq and PM QoS holds after this long without a request */
+#define ESDHC_PM_HOLD_IDLE_MS           100
+
 /*
  * The CMDTYPE of the CMD register (offset 0xE) should be set to
  * "11" when the STOP CMD12 is issued on imx53 to abort one
@@ -259,6 +271,32 @@ struct pltfm_imx_data {
         } multiblock_status;
         u32 is_ddr;
         struct pm_qos_request pm_qos_req;
+
+        /* manual tuning result, see esdhc_executing_tuning() */
+        DECLARE_BITMAP(tuning_tested, ESDHC_TUNE_CTRL_TAPS);
+        DECLARE_BITMAP(tuning_passed, ESDHC_TUNE_CTRL_TAPS);
+        unsigned int tuning_win_start;
+        unsigned int tuning_win_end;
+        unsigned int tuning_tap;
+        int tuning_err;
+        struct dentry *tuning_dentry;
+
+        /* bus freq and PM QoS holds, see esdhc_request() */
+        void (*request)(struct mmc_host *mmc, struct mmc_request *mrq);
+        int (*cqe_request)(struct mmc_host *mmc, struct mmc_request *mrq);
+        struct mmc_cqe_ops cqe_ops;
+        struct cqhci_host *cq_host;
+        struct mutex pm_hold_lock;
+        struct delayed_work pm_release_work;
+        unsigned long pm_last_busy;
+        u32 pm_idle_ms;
+        bool pm_held;
+        unsigned int pm_holds;
+        unsigned int pm_releases;
+        u64 pm_ramp_ns;
+        u64 pm_ramp_max_ns;
+        struct dentry *pm_hold_dentry;
+        struct dentry *pm_idle_dentry;
 };
 
 static const struct platform_device_id imx_esdhc_devtype[] = {
@@ -301,6 +339,1080 @@ static inline int esdhc_is_usdhc(struct pltfm_imx_data *data)
         return !!(data->socdata->flags & ESDHC_FLAG_USDHC);
 }
 
+static inline int is_imx25_esdhc(struct pltfm_imx_data *data)
+{
+	return data->socdata == &esdhc_imx25_data;
+}
+
+static inline void esdhc_clrset_le(struct sdhci_host *host, u32 mask,
+				   u32 val, int reg)
+{
+	void __iomem *base = host->ioaddr + (reg & ~0x3);
+	u32 shift = (reg & 0x3) * 8;
+
+	writel(((readl(base) & ~(mask << shift)) | (val << shift)), base);
+}
+
+/*
+ * The generic SDHCI code accesses the standard register layout. The eSDHC
+ * and uSDHC blocks only have 32-bit registers, keep several standard
+ * fields in other places (MIX_CTRL, VENDOR_SPEC, PROCTL) and report some
+ * bits at other positions, so translate every access here.
+ */
+static u32 esdhc_readl_le(struct sdhci_host *host, int reg)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	u32 val = readl(host->ioaddr + reg);
+
+	if (unlikely(reg == SDHCI_PRESENT_STATE)) {
+		u32 fsl_prss = val;
+		/* save the least 20 bits */
+		val = fsl_prss & 0x000FFFFF;
+		/* move dat[0-3] bits */
+		val |= (fsl_prss & 0x0F000000) >> 4;
+		/* move cmd line bit */
+		val |= (fsl_prss & 0x00800000) << 1;
+	}
+
+	if (unlikely(reg == SDHCI_CAPABILITIES)) {
+		/* ignore bit[0-15] as it stores cap_1 register val for mx6sl */
+		if (imx_data->socdata->flags & ESDHC_FLAG_HAVE_CAP1)
+			val &= 0xffff0000;
+
+		/*
+		 * In FSL esdhc IC module, only bit20 is used to indicate the
+		 * ADMA2 capability of esdhc, but this bit is messed up on
+		 * some SOCs (e.g. on MX25, MX35 this bit is set, but they
+		 * don't actually support ADMA2). So set the BROKEN_ADMA
+		 * quirk on MX25/35 platforms.
+		 */
+		if (val & SDHCI_CAN_DO_ADMA1) {
+			val &= ~SDHCI_CAN_DO_ADMA1;
+			val |= SDHCI_CAN_DO_ADMA2;
+		}
+	}
+
+	if (unlikely(reg == SDHCI_CAPABILITIES_1)) {
+		if (esdhc_is_usdhc(imx_data)) {
+			if (imx_data->socdata->flags & ESDHC_FLAG_HAVE_CAP1)
+				val = readl(host->ioaddr + SDHCI_CAPABILITIES) &
+				      0xFFFF;
+			else
+				/* imx6q/dl does not have cap_1 register, fake one */
+				val = SDHCI_SUPPORT_DDR50 | SDHCI_SUPPORT_SDR104
+					| SDHCI_SUPPORT_SDR50
+					| SDHCI_USE_SDR50_TUNING
+					| (SDHCI_TUNING_MODE_3 <<
+					   SDHCI_RETUNING_MODE_SHIFT);
+
+			if (imx_data->socdata->flags & ESDHC_FLAG_HS400)
+				val |= SDHCI_SUPPORT_HS400;
+		}
+	}
+
+	if (unlikely(reg == SDHCI_MAX_CURRENT) && esdhc_is_usdhc(imx_data)) {
+		val = 0;
+		val |= 0xFF << SDHCI_MAX_CURRENT_330_SHIFT;
+		val |= 0xFF << SDHCI_MAX_CURRENT_300_SHIFT;
+		val |= 0xFF << SDHCI_MAX_CURRENT_180_SHIFT;
+	}
+
+	if (unlikely(reg == SDHCI_INT_STATUS)) {
+		if (val & ESDHC_INT_VENDOR_SPEC_DMA_ERR) {
+			val &= ~ESDHC_INT_VENDOR_SPEC_DMA_ERR;
+			val |= SDHCI_INT_ADMA_ERROR;
+		}
+
+		/*
+		 * mask off the interrupt we get in response to the manually
+		 * sent CMD12
+		 */
+		if ((imx_data->multiblock_status == WAIT_FOR_INT) &&
+		    ((val & SDHCI_INT_RESPONSE) == SDHCI_INT_RESPONSE)) {
+			val &= ~SDHCI_INT_RESPONSE;
+			writel(SDHCI_INT_RESPONSE, host->ioaddr +
+						   SDHCI_INT_STATUS);
+			imx_data->multiblock_status = NO_CMD_PENDING;
+		}
+	}
+
+	return val;
+}
+
+static void esdhc_writel_le(struct sdhci_host *host, u32 val, int reg)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	u32 data;
+
+	if (unlikely(reg == SDHCI_INT_ENABLE || reg == SDHCI_SIGNAL_ENABLE ||
+		     reg == SDHCI_INT_STATUS)) {
+		if ((val & SDHCI_INT_CARD_INT) && !esdhc_is_usdhc(imx_data)) {
+			/*
+			 * Clear and then set D3CD bit to avoid missing the
+			 * card interrupt. This is an eSDHC controller problem
+			 * so we need to apply the following workaround: clear
+			 * and set D3CD bit will make eSDHC re-sample the card
+			 * interrupt. In case a card interrupt was lost,
+			 * re-sample it by the following steps.
+			 */
+			data = readl(host->ioaddr + SDHCI_HOST_CONTROL);
+			data &= ~ESDHC_CTRL_D3CD;
+			writel(data, host->ioaddr + SDHCI_HOST_CONTROL);
+			data |= ESDHC_CTRL_D3CD;
+			writel(data, host->ioaddr + SDHCI_HOST_CONTROL);
+		}
+
+		if (val & SDHCI_INT_ADMA_ERROR) {
+			val &= ~SDHCI_INT_ADMA_ERROR;
+			val |= ESDHC_INT_VENDOR_SPEC_DMA_ERR;
+		}
+	}
+
+	if (unlikely((imx_data->socdata->flags & ESDHC_FLAG_MULTIBLK_NO_INT) &&
+		     (reg == SDHCI_INT_STATUS) &&
+		     (val & SDHCI_INT_DATA_END))) {
+		u32 v;
+
+		v = readl(host->ioaddr + ESDHC_VENDOR_SPEC);
+		v &= ~ESDHC_VENDOR_SPEC_SDIO_QUIRK;
+		writel(v, host->ioaddr + ESDHC_VENDOR_SPEC);
+
+		if (imx_data->multiblock_status == MULTIBLK_IN_PROCESS) {
+			/* send a manual CMD12 with RESPTYP=none */
+			data = MMC_STOP_TRANSMISSION << 24 |
+			       SDHCI_CMD_ABORTCMD << 16;
+			writel(data, host->ioaddr + SDHCI_TRANSFER_MODE);
+			imx_data->multiblock_status = WAIT_FOR_INT;
+		}
+	}
+
+	writel(val, host->ioaddr + reg);
+}
+
+static u16 esdhc_readw_le(struct sdhci_host *host, int reg)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	u16 ret = 0;
+	u32 val;
+
+	if (unlikely(reg == SDHCI_HOST_VERSION)) {
+		reg ^= 2;
+		if (esdhc_is_usdhc(imx_data)) {
+			/*
+			 * The usdhc register returns a wrong host version.
+			 * Correct it here.
+			 */
+			return SDHCI_SPEC_300;
+		}
+	}
+
+	if (unlikely(reg == SDHCI_HOST_CONTROL2)) {
+		val = readl(host->ioaddr + ESDHC_VENDOR_SPEC);
+		if (val & ESDHC_VENDOR_SPEC_VSELECT)
+			ret |= SDHCI_CTRL_VDD_180;
+
+		if (esdhc_is_usdhc(imx_data)) {
+			if (imx_data->socdata->flags & ESDHC_FLAG_MAN_TUNING)
+				val = readl(host->ioaddr + ESDHC_MIX_CTRL);
+			else if (imx_data->socdata->flags & ESDHC_FLAG_STD_TUNING)
+				/* the std tuning bits is in ACMD12_ERR for imx6sl */
+				val = readl(host->ioaddr + SDHCI_ACMD12_ERR);
+		}
+
+		if (val & ESDHC_MIX_CTRL_EXE_TUNE)
+			ret |= SDHCI_CTRL_EXEC_TUNING;
+		if (val & ESDHC_MIX_CTRL_SMPCLK_SEL)
+			ret |= SDHCI_CTRL_TUNED_CLK;
+
+		ret &= ~SDHCI_CTRL_PRESET_VAL_ENABLE;
+
+		return ret;
+	}
+
+	if (unlikely(reg == SDHCI_TRANSFER_MODE)) {
+		if (esdhc_is_usdhc(imx_data)) {
+			u32 m = readl(host->ioaddr + ESDHC_MIX_CTRL);
+
+			ret = m & ESDHC_MIX_CTRL_SDHCI_MASK;
+			/* Swap AC23 bit */
+			if (m & ESDHC_MIX_CTRL_AC23EN) {
+				ret &= ~ESDHC_MIX_CTRL_AC23EN;
+				ret |= SDHCI_TRNS_AUTO_CMD23;
+			}
+		} else {
+			ret = readw(host->ioaddr + SDHCI_TRANSFER_MODE);
+		}
+
+		return ret;
+	}
+
+	return readw(host->ioaddr + reg);
+}
+
+static void esdhc_writew_le(struct sdhci_host *host, u16 val, int reg)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	u32 new_val = 0;
+
+	switch (reg) {
+	case SDHCI_CLOCK_CONTROL:
+		new_val = readl(host->ioaddr + ESDHC_VENDOR_SPEC);
+		if (val & SDHCI_CLOCK_CARD_EN)
+			new_val |= ESDHC_VENDOR_SPEC_FRC_SDCLK_ON;
+		else
+			new_val &= ~ESDHC_VENDOR_SPEC_FRC_SDCLK_ON;
+		writel(new_val, host->ioaddr + ESDHC_VENDOR_SPEC);
+		return;
+	case SDHCI_HOST_CONTROL2:
+		new_val = readl(host->ioaddr + ESDHC_VENDOR_SPEC);
+		if (val & SDHCI_CTRL_VDD_180)
+			new_val |= ESDHC_VENDOR_SPEC_VSELECT;
+		else
+			new_val &= ~ESDHC_VENDOR_SPEC_VSELECT;
+		writel(new_val, host->ioaddr + ESDHC_VENDOR_SPEC);
+		if (imx_data->socdata->flags & ESDHC_FLAG_MAN_TUNING) {
+			new_val = readl(host->ioaddr + ESDHC_MIX_CTRL);
+			if (val & SDHCI_CTRL_TUNED_CLK) {
+				new_val |= ESDHC_MIX_CTRL_SMPCLK_SEL;
+				new_val |= ESDHC_MIX_CTRL_AUTO_TUNE_EN;
+			} else {
+				new_val &= ~ESDHC_MIX_CTRL_SMPCLK_SEL;
+				new_val &= ~ESDHC_MIX_CTRL_AUTO_TUNE_EN;
+			}
+			writel(new_val, host->ioaddr + ESDHC_MIX_CTRL);
+		} else if (imx_data->socdata->flags & ESDHC_FLAG_STD_TUNING) {
+			u32 v = readl(host->ioaddr + SDHCI_ACMD12_ERR);
+			u32 m = readl(host->ioaddr + ESDHC_MIX_CTRL);
+
+			if (val & SDHCI_CTRL_TUNED_CLK) {
+				v |= ESDHC_MIX_CTRL_SMPCLK_SEL;
+			} else {
+				v &= ~ESDHC_MIX_CTRL_SMPCLK_SEL;
+				m &= ~ESDHC_MIX_CTRL_FBCLK_SEL;
+				m &= ~ESDHC_MIX_CTRL_AUTO_TUNE_EN;
+			}
+
+			if (val & SDHCI_CTRL_EXEC_TUNING) {
+				v |= ESDHC_MIX_CTRL_EXE_TUNE;
+				m |= ESDHC_MIX_CTRL_FBCLK_SEL;
+				m |= ESDHC_MIX_CTRL_AUTO_TUNE_EN;
+			} else {
+				v &= ~ESDHC_MIX_CTRL_EXE_TUNE;
+			}
+
+			writel(v, host->ioaddr + SDHCI_ACMD12_ERR);
+			writel(m, host->ioaddr + ESDHC_MIX_CTRL);
+		}
+		return;
+	case SDHCI_TRANSFER_MODE:
+		if ((imx_data->socdata->flags & ESDHC_FLAG_MULTIBLK_NO_INT) &&
+		    (host->cmd->opcode == SD_IO_RW_EXTENDED) &&
+		    (host->cmd->data->blocks > 1) &&
+		    (host->cmd->data->flags & MMC_DATA_READ)) {
+			u32 v;
+
+			v = readl(host->ioaddr + ESDHC_VENDOR_SPEC);
+			v |= ESDHC_VENDOR_SPEC_SDIO_QUIRK;
+			writel(v, host->ioaddr + ESDHC_VENDOR_SPEC);
+		}
+
+		if (esdhc_is_usdhc(imx_data)) {
+			u32 m = readl(host->ioaddr + ESDHC_MIX_CTRL);
+
+			/* Swap AC23 bit */
+			if (val & SDHCI_TRNS_AUTO_CMD23) {
+				val &= ~SDHCI_TRNS_AUTO_CMD23;
+				val |= ESDHC_MIX_CTRL_AC23EN;
+			}
+			m = val | (m & ~ESDHC_MIX_CTRL_SDHCI_MASK);
+			writel(m, host->ioaddr + ESDHC_MIX_CTRL);
+		} else {
+			/*
+			 * Postpone this write, we must do it together with a
+			 * command write that is down below.
+			 */
+			imx_data->scratchpad = val;
+		}
+		return;
+	case SDHCI_COMMAND:
+		if (host->cmd->opcode == MMC_STOP_TRANSMISSION)
+			val |= SDHCI_CMD_ABORTCMD;
+
+		if ((host->cmd->opcode == MMC_SET_BLOCK_COUNT) &&
+		    (imx_data->socdata->flags & ESDHC_FLAG_MULTIBLK_NO_INT))
+			imx_data->multiblock_status = MULTIBLK_IN_PROCESS;
+
+		if (esdhc_is_usdhc(imx_data))
+			writel(val << 16,
+			       host->ioaddr + SDHCI_TRANSFER_MODE);
+		else
+			writel(val << 16 | imx_data->scratchpad,
+			       host->ioaddr + SDHCI_TRANSFER_MODE);
+		return;
+	case SDHCI_BLOCK_SIZE:
+		val &= ~SDHCI_MAKE_BLKSZ(0x7, 0);
+		break;
+	}
+	esdhc_clrset_le(host, 0xffff, val, reg);
+}
+
+static u8 esdhc_readb_le(struct sdhci_host *host, int reg)
+{
+	u8 ret;
+	u32 val;
+
+	switch (reg) {
+	case SDHCI_HOST_CONTROL:
+		val = readl(host->ioaddr + reg);
+
+		ret = val & SDHCI_CTRL_LED;
+		ret |= (val >> 5) & SDHCI_CTRL_DMA_MASK;
+		ret |= (val & ESDHC_CTRL_4BITBUS);
+		ret |= (val & ESDHC_CTRL_8BITBUS) << 3;
+		return ret;
+	}
+
+	return readb(host->ioaddr + reg);
+}
+
+/* Reset-all fix-ups of SYS_CTRL and MIX_CTRL are done in esdhc_reset() */
+static void esdhc_writeb_le(struct sdhci_host *host, u8 val, int reg)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	u32 new_val = 0;
+	u32 mask;
+
+	switch (reg) {
+	case SDHCI_POWER_CONTROL:
+		/*
+		 * FSL put some DMA bits here
+		 * If your board has a regulator, code should be here
+		 */
+		return;
+	case SDHCI_HOST_CONTROL:
+		/* FSL messed up here, so we need to manually compose it. */
+		new_val = val & SDHCI_CTRL_LED;
+		/* ensure the endianness */
+		new_val |= ESDHC_HOST_CONTROL_LE;
+		/* bits 8&9 are reserved on mx25 */
+		if (!is_imx25_esdhc(imx_data)) {
+			/* DMA mode bits are shifted */
+			new_val |= (val & SDHCI_CTRL_DMA_MASK) << 5;
+		}
+
+		/*
+		 * Do not touch buswidth bits here. This is done in
+		 * esdhc_pltfm_set_bus_width.
+		 * Do not touch the D3CD bit either which is used for the
+		 * SDIO interrupt erratum workaround.
+		 */
+		mask = 0xffff & ~(ESDHC_CTRL_BUSWIDTH_MASK | ESDHC_CTRL_D3CD);
+
+		esdhc_clrset_le(host, mask, new_val, reg);
+		return;
+	case SDHCI_SOFTWARE_RESET:
+		if (val & SDHCI_RESET_DATA)
+			new_val = readl(host->ioaddr + SDHCI_HOST_CONTROL);
+		break;
+	}
+	esdhc_clrset_le(host, 0xff, val, reg);
+
+	if (reg == SDHCI_SOFTWARE_RESET && !(val & SDHCI_RESET_ALL) &&
+	    (val & SDHCI_RESET_DATA)) {
+		/*
+		 * The eSDHC DAT line software reset clears at least the
+		 * data transfer width on i.MX25, so make sure that the
+		 * Host Control register is unaffected.
+		 */
+		esdhc_clrset_le(host, 0xff, new_val, SDHCI_HOST_CONTROL);
+	}
+}
+
+static void esdhc_prepare_tuning(struct sdhci_host *host, u32 val)
+{
+	u32 reg;
+
+	reg = sdhci_readl(host, ESDHC_MIX_CTRL);
+	reg |= ESDHC_MIX_CTRL_EXE_TUNE | ESDHC_MIX_CTRL_SMPCLK_SEL |
+			ESDHC_MIX_CTRL_FBCLK_SEL;
+	sdhci_writel(host, reg, ESDHC_MIX_CTRL);
+	writel(val << ESDHC_TUNE_CTRL_SHIFT,
+	       host->ioaddr + ESDHC_TUNE_CTRL_STATUS);
+	dev_dbg(mmc_dev(host->mmc),
+		"tuning with delay 0x%x ESDHC_TUNE_CTRL_STATUS 0x%x\n",
+			val, readl(host->ioaddr + ESDHC_TUNE_CTRL_STATUS));
+}
+
+static void esdhc_post_tuning(struct sdhci_host *host)
+{
+	u32 reg;
+
+	reg = sdhci_readl(host, ESDHC_MIX_CTRL);
+	reg &= ~ESDHC_MIX_CTRL_EXE_TUNE;
+	reg |= ESDHC_MIX_CTRL_AUTO_TUNE_EN;
+	sdhci_writel(host, reg, ESDHC_MIX_CTRL);
+}
+
+static unsigned int esdhc_tuning_step(struct pltfm_imx_data *imx_data)
+{
+	return imx_data->boarddata.tuning_step ?: ESDHC_TUNE_CTRL_STEP;
+}
+
+/* Sample the tuning block at one delay cell setting and record the result */
+static int esdhc_tune_tap(struct sdhci_host *host, u32 opcode,
+			  unsigned int tap)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	int ret;
+
+	esdhc_prepare_tuning(host, tap);
+	ret = mmc_send_tuning(host->mmc, opcode, NULL);
+
+	set_bit(tap, imx_data->tuning_tested);
+	if (!ret)
+		set_bit(tap, imx_data->tuning_passed);
+	else if (host->tuning_delay > 0)
+		/* give the card a moment to recover from the failed block */
+		mdelay(host->tuning_delay);
+
+	return ret;
+}
+
+/*
+ * Pick the widest run of passing taps from the map and sample in its
+ * centre, which leaves the most margin for drift on both sides.
+ */
+static int esdhc_select_tuning_tap(struct pltfm_imx_data *imx_data)
+{
+	unsigned int step = esdhc_tuning_step(imx_data);
+	unsigned int tap, start = 0, len = 0;
+	unsigned int best_start = 0, best_len = 0;
+
+	for (tap = ESDHC_TUNE_CTRL_MIN; tap <= ESDHC_TUNE_CTRL_MAX;
+	     tap += step) {
+		if (!test_bit(tap, imx_data->tuning_passed)) {
+			len = 0;
+			continue;
+		}
+
+		if (!len++)
+			start = tap;
+		if (len > best_len) {
+			best_start = start;
+			best_len = len;
+		}
+	}
+
+	if (!best_len)
+		return -EIO;
+
+	imx_data->tuning_win_start = best_start;
+	imx_data->tuning_win_end = best_start + (best_len - 1) * step;
+	imx_data->tuning_tap = best_start + (best_len - 1) / 2 * step;
+
+	return 0;
+}
+
+static int esdhc_tuning_map_show(struct seq_file *s, void *data)
+{
+	struct sdhci_host *host = s->private;
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	unsigned int tap;
+
+	seq_printf(s, "result:\t\t%d\n", imx_data->tuning_err);
+	seq_printf(s, "step:\t\t%u\n", esdhc_tuning_step(imx_data));
+	if (!imx_data->tuning_err) {
+		seq_printf(s, "window:\t\t%u-%u\n", imx_data->tuning_win_start,
+			   imx_data->tuning_win_end);
+		seq_printf(s, "tap:\t\t%u\n", imx_data->tuning_tap);
+	}
+
+	/* one character per tap: '+' passed, '-' failed, '.' not sampled */
+	seq_puts(s, "map:\t\t");
+	for (tap = ESDHC_TUNE_CTRL_MIN; tap <= ESDHC_TUNE_CTRL_MAX; tap++) {
+		if (!test_bit(tap, imx_data->tuning_tested))
+			seq_putc(s, '.');
+		else if (test_bit(tap, imx_data->tuning_passed))
+			seq_putc(s, '+');
+		else
+			seq_putc(s, '-');
+	}
+	seq_putc(s, '\n');
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(esdhc_tuning_map);
+
+/*
+ * Bisect between a failing and a passing tap index, assuming a single
+ * pass/fail transition in between, and return the passing index next to
+ * the transition.
+ */
+static unsigned int esdhc_tune_edge(struct sdhci_host *host, u32 opcode,
+				    unsigned int step, unsigned int fail,
+				    unsigned int pass)
+{
+	unsigned int mid;
+
+	while (abs((int)pass - (int)fail) > 1) {
+		mid = (fail + pass) / 2;
+		if (esdhc_tune_tap(host, opcode, ESDHC_TUNE_CTRL_MIN + mid * step))
+			fail = mid;
+		else
+			pass = mid;
+	}
+
+	return pass;
+}
+
+/*
+ * Find the widest passing window with a coarse sweep and refine its two
+ * edges by bisection. Returns -EIO when the coarse sweep saw no passing
+ * tap, since a window narrower than the coarse step can only be found by
+ * sampling every tap.
+ */
+static int esdhc_search_tuning_window(struct sdhci_host *host, u32 opcode)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	unsigned int step = esdhc_tuning_step(imx_data);
+	unsigned int nr = (ESDHC_TUNE_CTRL_MAX - ESDHC_TUNE_CTRL_MIN) / step + 1;
+	unsigned int coarse = max(1U, ESDHC_TUNE_CTRL_COARSE_STEP / step);
+	unsigned int i, first = 0, len = 0, best_first = 0, best_len = 0;
+	unsigned int start, end, last;
+
+	for (i = 0; i < nr; i += coarse) {
+		if (esdhc_tune_tap(host, opcode, ESDHC_TUNE_CTRL_MIN + i * step)) {
+			len = 0;
+			continue;
+		}
+
+		if (!len++)
+			first = i;
+		if (len > best_len) {
+			best_first = first;
+			best_len = len;
+		}
+	}
+
+	if (!best_len)
+		return -EIO;
+
+	last = best_first + (best_len - 1) * coarse;
+
+	start = 0;
+	if (best_first)
+		start = esdhc_tune_edge(host, opcode, step,
+					best_first - coarse, best_first);
+
+	if (last + coarse < nr)
+		end = esdhc_tune_edge(host, opcode, step, last + coarse, last);
+	else if (last == nr - 1 ||
+		 !esdhc_tune_tap(host, opcode, ESDHC_TUNE_CTRL_MIN +
+						(nr - 1) * step))
+		end = nr - 1;
+	else
+		end = esdhc_tune_edge(host, opcode, step, nr - 1, last);
+
+	imx_data->tuning_win_start = ESDHC_TUNE_CTRL_MIN + start * step;
+	imx_data->tuning_win_end = ESDHC_TUNE_CTRL_MIN + end * step;
+	imx_data->tuning_tap = ESDHC_TUNE_CTRL_MIN + (start + end) / 2 * step;
+
+	return 0;
+}
+
+/*
+ * Manual tuning: find the widest passing window of delay cell settings,
+ * keep the pass/fail map and settle in the centre of the window rather
+ * than halfway between the first pass and the first fail after it.
+ *
+ * A coarse sweep plus bisection of the window edges normally needs a
+ * fraction of the tuning commands a full sweep does. If it sees no
+ * window, or the centre it picks does not pass, sample every tap.
+ */
+static int esdhc_executing_tuning(struct sdhci_host *host, u32 opcode)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	unsigned int step = esdhc_tuning_step(imx_data);
+	unsigned int tap;
+	int ret;
+
+	bitmap_zero(imx_data->tuning_tested, ESDHC_TUNE_CTRL_TAPS);
+	bitmap_zero(imx_data->tuning_passed, ESDHC_TUNE_CTRL_TAPS);
+
+	ret = esdhc_search_tuning_window(host, opcode);
+	if (!ret)
+		ret = esdhc_tune_tap(host, opcode, imx_data->tuning_tap);
+
+	if (ret) {
+		dev_dbg(mmc_dev(host->mmc), "tuning search failed, sweeping all taps\n");
+
+		for (tap = ESDHC_TUNE_CTRL_MIN; tap <= ESDHC_TUNE_CTRL_MAX;
+		     tap += step)
+			if (!test_bit(tap, imx_data->tuning_tested))
+				esdhc_tune_tap(host, opcode, tap);
+
+		ret = esdhc_select_tuning_tap(imx_data);
+		if (!ret) {
+			esdhc_prepare_tuning(host, imx_data->tuning_tap);
+			ret = mmc_send_tuning(host->mmc, opcode, NULL);
+		}
+	}
+	esdhc_post_tuning(host);
+
+	imx_data->tuning_err = ret;
+
+	dev_dbg(mmc_dev(host->mmc), "tuning %s at 0x%x ret %d, %u taps sampled\n",
+		ret ? "failed" : "passed", imx_data->tuning_tap, ret,
+		bitmap_weight(imx_data->tuning_tested, ESDHC_TUNE_CTRL_TAPS));
+
+	return ret;
+}
+
+static inline bool esdhc_has_pm_holds(struct pltfm_imx_data *imx_data)
+{
+	return imx_data->socdata->flags & (ESDHC_FLAG_BUSFREQ | ESDHC_FLAG_PMQOS);
+}
+
+static int esdhc_pm_hold_show(struct seq_file *s, void *data)
+{
+	struct sdhci_host *host = s->private;
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+
+	mutex_lock(&imx_data->pm_hold_lock);
+	seq_printf(s, "held:\t\t%d\n", imx_data->pm_held);
+	seq_printf(s, "holds:\t\t%u\n", imx_data->pm_holds);
+	seq_printf(s, "releases:\t%u\n", imx_data->pm_releases);
+	seq_printf(s, "ramp_avg_ns:\t%llu\n", imx_data->pm_holds ?
+		   div_u64(imx_data->pm_ramp_ns, imx_data->pm_holds) : 0);
+	seq_printf(s, "ramp_max_ns:\t%llu\n", imx_data->pm_ramp_max_ns);
+	mutex_unlock(&imx_data->pm_hold_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(esdhc_pm_hold);
+
+static int esdhc_pm_idle_get(void *data, u64 *val)
+{
+	struct sdhci_host *host = data;
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+
+	*val = READ_ONCE(imx_data->pm_idle_ms);
+
+	return 0;
+}
+
+static int esdhc_pm_idle_set(void *data, u64 val)
+{
+	struct sdhci_host *host = data;
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+
+	if (val > UINT_MAX)
+		return -EINVAL;
+
+	mutex_lock(&imx_data->pm_hold_lock);
+	WRITE_ONCE(imx_data->pm_idle_ms, val);
+	/* holds taken while pm_idle_ms was 0 have no release work pending */
+	if (imx_data->pm_held && val)
+		mod_delayed_work(system_freezable_wq,
+				 &imx_data->pm_release_work,
+				 msecs_to_jiffies(val));
+	mutex_unlock(&imx_data->pm_hold_lock);
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(esdhc_pm_idle_fops, esdhc_pm_idle_get,
+			esdhc_pm_idle_set, "%llu\n");
+
+/* debugfs_root only exists once the host has been added */
+static void esdhc_debugfs_init(struct sdhci_host *host)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	struct dentry *root = host->mmc->debugfs_root;
+
+	if (!root)
+		return;
+
+	if (imx_data->socdata->flags & ESDHC_FLAG_MAN_TUNING)
+		imx_data->tuning_dentry =
+			debugfs_create_file("tuning_map", S_IRUSR, root, host,
+					    &esdhc_tuning_map_fops);
+
+	if (esdhc_has_pm_holds(imx_data)) {
+		imx_data->pm_hold_dentry =
+			debugfs_create_file("pm_hold", S_IRUSR, root, host,
+					    &esdhc_pm_hold_fops);
+		imx_data->pm_idle_dentry =
+			debugfs_create_file("pm_idle_ms", S_IRUSR | S_IWUSR,
+					    root, host, &esdhc_pm_idle_fops);
+	}
+}
+
+/* Before sdhci_remove_host(), while the files' host is still valid */
+static void esdhc_debugfs_remove(struct pltfm_imx_data *imx_data)
+{
+	debugfs_remove(imx_data->tuning_dentry);
+	debugfs_remove(imx_data->pm_hold_dentry);
+	debugfs_remove(imx_data->pm_idle_dentry);
+	imx_data->tuning_dentry = NULL;
+	imx_data->pm_hold_dentry = NULL;
+	imx_data->pm_idle_dentry = NULL;
+}
+
+/*
+ * Raise the bus frequency and pin the CPU DMA latency for as long as
+ * requests keep coming. The time this takes is what the first request
+ * after an idle period pays, so keep track of it.
+ */
+static void esdhc_pm_hold_get(struct sdhci_host *host)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	ktime_t start = ktime_get();
+	u64 ns;
+
+	lockdep_assert_held(&imx_data->pm_hold_lock);
+
+	if (imx_data->socdata->flags & ESDHC_FLAG_BUSFREQ)
+		request_bus_freq(BUS_FREQ_HIGH);
+
+	if (imx_data->socdata->flags & ESDHC_FLAG_PMQOS)
+		pm_qos_add_request(&imx_data->pm_qos_req,
+			PM_QOS_CPU_DMA_LATENCY, 0);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	imx_data->pm_holds++;
+	imx_data->pm_ramp_ns += ns;
+	imx_data->pm_ramp_max_ns = max(imx_data->pm_ramp_max_ns, ns);
+	WRITE_ONCE(imx_data->pm_held, true);
+}
+
+static void esdhc_pm_hold_put(struct pltfm_imx_data *imx_data)
+{
+	lockdep_assert_held(&imx_data->pm_hold_lock);
+
+	if (!imx_data->pm_held)
+		return;
+
+	if (imx_data->socdata->flags & ESDHC_FLAG_BUSFREQ)
+		release_bus_freq(BUS_FREQ_HIGH);
+
+	if (imx_data->socdata->flags & ESDHC_FLAG_PMQOS)
+		pm_qos_remove_request(&imx_data->pm_qos_req);
+
+	imx_data->pm_releases++;
+	WRITE_ONCE(imx_data->pm_held, false);
+}
+
+/* Drop the holds right away, for suspend and removal. */
+static void esdhc_pm_hold_drop(struct pltfm_imx_data *imx_data)
+{
+	if (!esdhc_has_pm_holds(imx_data))
+		return;
+
+	cancel_delayed_work_sync(&imx_data->pm_release_work);
+
+	mutex_lock(&imx_data->pm_hold_lock);
+	esdhc_pm_hold_put(imx_data);
+	mutex_unlock(&imx_data->pm_hold_lock);
+}
+
+/*
+ * Runs pm_idle_ms after the holds were taken and re-arms itself until no
+ * request has been issued for that long and no CQE task is still queued.
+ * A pm_idle_ms of 0 keeps the holds until the next runtime suspend.
+ */
+static void esdhc_pm_release_work(struct work_struct *work)
+{
+	struct pltfm_imx_data *imx_data = container_of(to_delayed_work(work),
+					struct pltfm_imx_data, pm_release_work);
+	unsigned long idle, expires;
+
+	mutex_lock(&imx_data->pm_hold_lock);
+
+	idle = msecs_to_jiffies(READ_ONCE(imx_data->pm_idle_ms));
+	expires = READ_ONCE(imx_data->pm_last_busy) + idle;
+
+	/* CQE completions are not seen here, so wait for the queue to drain */
+	if (imx_data->cq_host && READ_ONCE(imx_data->cq_host->qcnt))
+		expires = max(expires, jiffies + idle);
+
+	if (idle && time_before(jiffies, expires))
+		queue_delayed_work(system_freezable_wq,
+				   &imx_data->pm_release_work,
+				   expires - jiffies);
+	else if (idle)
+		esdhc_pm_hold_put(imx_data);
+
+	mutex_unlock(&imx_data->pm_hold_lock);
+}
+
+/*
+ * Requests are issued from process context, so the first one after an
+ * idle period can take the holds itself; every later one only refreshes
+ * the idle stamp.
+ */
+static void esdhc_pm_busy(struct sdhci_host *host)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+
+	WRITE_ONCE(imx_data->pm_last_busy, jiffies);
+
+	if (!READ_ONCE(imx_data->pm_held)) {
+		mutex_lock(&imx_data->pm_hold_lock);
+		if (!imx_data->pm_held) {
+			esdhc_pm_hold_get(host);
+			if (imx_data->pm_idle_ms)
+				queue_delayed_work(system_freezable_wq,
+					&imx_data->pm_release_work,
+					msecs_to_jiffies(imx_data->pm_idle_ms));
+		}
+		mutex_unlock(&imx_data->pm_hold_lock);
+	}
+}
+
+static void esdhc_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+
+	esdhc_pm_busy(host);
+	imx_data->request(mmc, mrq);
+}
+
+/* CQE tasks and DCMDs are issued through ->cqe_request(), not ->request() */
+static int esdhc_cqe_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+
+	esdhc_pm_busy(host);
+	return imx_data->cqe_request(mmc, mrq);
+}
+
+/* Called once cqhci_init() has installed the engine's ops. */
+static void esdhc_pm_hold_cqe(struct sdhci_host *host)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	struct mmc_host *mmc = host->mmc;
+
+	imx_data->cq_host = mmc->cqe_private;
+	imx_data->cqe_ops = *mmc->cqe_ops;
+	imx_data->cqe_request = mmc->cqe_ops->cqe_request;
+	imx_data->cqe_ops.cqe_request = esdhc_cqe_request;
+	mmc->cqe_ops = &imx_data->cqe_ops;
+}
+
+/*
+ * The SD clock divider lives in SYS_CTRL as a power-of-two prescaler and a
+ * linear divider, not in the SDHCI clock control layout.
+ */
+static void esdhc_pltfm_set_clock(struct sdhci_host *host, unsigned int clock)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	unsigned int host_clock = pltfm_host->clock;
+	int ddr_pre_div = imx_data->is_ddr ? 2 : 1;
+	int pre_div = 1;
+	int div = 1;
+	u32 temp, val;
+
+	if (clock == 0) {
+		host->mmc->actual_clock = 0;
+		if (esdhc_is_usdhc(imx_data)) {
+			val = sdhci_readl(host, ESDHC_VENDOR_SPEC);
+			sdhci_writel(host, val & ~ESDHC_VENDOR_SPEC_FRC_SDCLK_ON,
+				     ESDHC_VENDOR_SPEC);
+		}
+		return;
+	}
+
+	temp = sdhci_readl(host, ESDHC_SYSTEM_CONTROL);
+	temp &= ~(ESDHC_CLOCK_IPGEN | ESDHC_CLOCK_HCKEN | ESDHC_CLOCK_PEREN |
+		  ESDHC_CLOCK_MASK);
+	sdhci_writel(host, temp, ESDHC_SYSTEM_CONTROL);
+
+	while (host_clock / (16 * pre_div * ddr_pre_div) > clock &&
+	       pre_div < 256)
+		pre_div *= 2;
+
+	while (host_clock / (div * pre_div * ddr_pre_div) > clock && div < 16)
+		div++;
+
+	host->mmc->actual_clock = host_clock / (div * pre_div * ddr_pre_div);
+	dev_dbg(mmc_dev(host->mmc), "desired SD clock: %d, actual: %d\n",
+		clock, host->mmc->actual_clock);
+
+	pre_div >>= 1;
+	div--;
+
+	temp |= ESDHC_CLOCK_IPGEN | ESDHC_CLOCK_HCKEN | ESDHC_CLOCK_PEREN |
+		(div << ESDHC_DIVIDER_SHIFT) | (pre_div << ESDHC_PREDIV_SHIFT);
+	sdhci_writel(host, temp, ESDHC_SYSTEM_CONTROL);
+
+	if (esdhc_is_usdhc(imx_data)) {
+		val = sdhci_readl(host, ESDHC_VENDOR_SPEC);
+		sdhci_writel(host, val | ESDHC_VENDOR_SPEC_FRC_SDCLK_ON,
+			     ESDHC_VENDOR_SPEC);
+	}
+
+	mdelay(1);
+}
+
+static unsigned int esdhc_pltfm_get_max_clock(struct sdhci_host *host)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+
+	return pltfm_host->clock;
+}
+
+static unsigned int esdhc_pltfm_get_min_clock(struct sdhci_host *host)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+
+	return pltfm_host->clock / 256 / 16;
+}
+
+/* PROT_CTRL keeps the data width in bits 1-2, 8-bit is not bit 5 here */
+static void esdhc_pltfm_set_bus_width(struct sdhci_host *host, int width)
+{
+	u32 ctrl;
+
+	ctrl = sdhci_readl(host, ESDHC_PROCTL);
+	ctrl &= ~ESDHC_CTRL_BUSWIDTH_MASK;
+	if (width == MMC_BUS_WIDTH_8)
+		ctrl |= ESDHC_CTRL_8BITBUS;
+	else if (width == MMC_BUS_WIDTH_4)
+		ctrl |= ESDHC_CTRL_4BITBUS;
+	sdhci_writel(host, ctrl, ESDHC_PROCTL);
+}
+
+/* HS400 samples on the data strobe, lock the DLL that delays it */
+static void esdhc_set_strobe_dll(struct sdhci_host *host)
+{
+	u32 v;
+
+	/* gate the card clock while the DLL locks */
+	v = sdhci_readl(host, ESDHC_VENDOR_SPEC);
+	sdhci_writel(host, v & ~ESDHC_VENDOR_SPEC_FRC_SDCLK_ON,
+		     ESDHC_VENDOR_SPEC);
+
+	writel(ESDHC_STROBE_DLL_CTRL_RESET,
+	       host->ioaddr + ESDHC_STROBE_DLL_CTRL);
+	v = ESDHC_STROBE_DLL_CTRL_ENABLE |
+	    ESDHC_STROBE_DLL_CTRL_SLV_UPDATE_INT_DEFAULT |
+	    (ESDHC_STROBE_DLL_CTRL_SLV_DLY_TARGET_DEFAULT <<
+	     ESDHC_STROBE_DLL_CTRL_SLV_DLY_TARGET_SHIFT);
+	writel(v, host->ioaddr + ESDHC_STROBE_DLL_CTRL);
+
+	/* the status register settles within a microsecond */
+	udelay(1);
+	v = readl(host->ioaddr + ESDHC_STROBE_DLL_STATUS);
+	if (!(v & ESDHC_STROBE_DLL_STS_REF_LOCK))
+		dev_warn(mmc_dev(host->mmc),
+			 "HS400 strobe DLL reference not locked\n");
+	if (!(v & ESDHC_STROBE_DLL_STS_SLV_LOCK))
+		dev_warn(mmc_dev(host->mmc),
+			 "HS400 strobe DLL slave not locked\n");
+}
+
+/* uSDHC selects DDR in MIX_CTRL, HOST_CONTROL2 has no speed mode field */
+static void esdhc_set_uhs_signaling(struct sdhci_host *host, unsigned timing)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	u32 m;
+
+	if (!esdhc_is_usdhc(imx_data))
+		return;
+
+	m = sdhci_readl(host, ESDHC_MIX_CTRL);
+	m &= ~(ESDHC_MIX_CTRL_DDREN | ESDHC_MIX_CTRL_HS400_EN);
+	imx_data->is_ddr = 0;
+
+	switch (timing) {
+	case MMC_TIMING_UHS_DDR50:
+	case MMC_TIMING_MMC_DDR52:
+		m |= ESDHC_MIX_CTRL_DDREN;
+		imx_data->is_ddr = 1;
+		break;
+	case MMC_TIMING_MMC_HS400:
+		m |= ESDHC_MIX_CTRL_DDREN | ESDHC_MIX_CTRL_HS400_EN;
+		imx_data->is_ddr = 1;
+		break;
+	}
+
+	sdhci_writel(host, m, ESDHC_MIX_CTRL);
+
+	if (timing == MMC_TIMING_MMC_HS400) {
+		/* the DLL locks against the DDR divided clock */
+		esdhc_pltfm_set_clock(host, host->clock);
+		esdhc_set_strobe_dll(host);
+	}
+}
+
+static void esdhc_reset(struct sdhci_host *host, u8 mask)
+{
+	struct sdhci_pltfm_host *pltfm_host = sdhci_priv(host);
+	struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
+	u32 val;
+
+	sdhci_reset(host, mask);
+
+	if (mask & SDHCI_RESET_ALL) {
+		/*
+		 * Reset-all stops the ipg/ahb/per clocks card detection runs
+		 * on, turn them back on.
+		 */
+		val = sdhci_readl(host, ESDHC_SYSTEM_CONTROL);
+		val |= ESDHC_CLOCK_IPGEN | ESDHC_CLOCK_HCKEN |
+		       ESDHC_CLOCK_PEREN;
+		sdhci_writel(host, val, ESDHC_SYSTEM_CONTROL);
+
+		/* ... and on uSDHC leaves MIX_CTRL set, keep only tuning */
+		if (esdhc_is_usdhc(imx_data)) {
+			val = sdhci_readl(host, ESDHC_MIX_CTRL);
+			sdhci_writel(host, val & ESDHC_MIX_CTRL_TUNING_MASK,
+				     ESDHC_MIX_CTRL);
+			imx_data->is_ddr = 0;
+		}
+	}
+
+	/* the reset clears the interrupt enables as well */
+	sdhci_writel(host, host->ier, SDHCI_INT_ENABLE);
+	sdhci_writel(host, host->ier, SDHCI_SIGNAL_ENABLE);
+}
+
+static struct sdhci_ops sdhci_esdhc_ops = {
+	.read_l = esdhc_readl_le,
+	.read_w = esdhc_readw_le,
+	.read_b = esdhc_readb_le,
+	.write_l = esdhc_writel_le,
+	.write_w = esdhc_writew_le,
+	.write_b = esdhc_writeb_le,
+	.set_clock = esdhc_pltfm_set_clock,
+	.get_max_clock = esdhc_pltfm_get_max_clock,
+	.get_min_clock = esdhc_pltfm_get_min_clock,
+	.set_bus_width = esdhc_pltfm_set_bus_width,
+	.set_uhs_signaling = esdhc_set_uhs_signaling,
+	.reset = esdhc_reset,
+};
 
 
 static const struct sdhci_pltfm_data sdhci_esdhc_imx_pdata = {
@@ -309,9 +1421,11 @@ static const struct sdhci_pltfm_data sdhci_esdhc_imx_pdata = {
                         | SDHCI_QUIRK_NO_ENDATTR_IN_NOPDESC
                         | SDHCI_QUIRK_BROKEN_ADMA_ZEROLEN_DESC
                         | SDHCI_QUIRK_BROKEN_CARD_DETECTION,
-//        .ops = &sdhci_esdhc_ops,
+        .ops = &sdhci_esdhc_ops,
 };
 
+static void sdhci_esdhc_imx_hwinit(struct sdhci_host *host);
+
 static int sdhci_esdhc_imx_probe(struct platform_device *pdev)
 {
 	const struct of_device_id *of_id =
@@ -358,12 +1472,13 @@ static int sdhci_esdhc_imx_probe(struct platform_device *pdev)
         pltfm_host->clk = imx_data->clk_per;
         pltfm_host->clock = clk_get_rate(pltfm_host->clk);
 
-	if (imx_data->socdata->flags & ESDHC_FLAG_BUSFREQ)
-                request_bus_freq(BUS_FREQ_HIGH);
-
-        if (imx_data->socdata->flags & ESDHC_FLAG_PMQOS)
-                pm_qos_add_request(&imx_data->pm_qos_req,
-                        PM_QOS_CPU_DMA_LATENCY, 0);
+        /* bus freq and PM QoS are only held while requests come in */
+        mutex_init(&imx_data->pm_hold_lock);
+        INIT_DELAYED_WORK(&imx_data->pm_release_work, esdhc_pm_release_work);
+        imx_data->pm_idle_ms = ESDHC_PM_HOLD_IDLE_MS;
+        imx_data->request = host->mmc_host_ops.request;
+        if (esdhc_has_pm_holds(imx_data))
+                host->mmc_host_ops.request = esdhc_request;
 
         err = clk_prepare_enable(imx_data->clk_per);
         if (err)
@@ -393,15 +1508,47 @@ static int sdhci_esdhc_imx_probe(struct platform_device *pdev)
                 if (!(imx_data->socdata->flags & ESDHC_FLAG_HS200))
                         host->quirks2 |= SDHCI_QUIRK2_BROKEN_HS200;
 
+                /*
+                 * The clock gate in VENDOR_SPEC is only ever changed by
+                 * us. So is MIX_CTRL with manual tuning; standard tuning
+                 * has the controller clear EXE_TUNE and SMPCLK_SEL, which
+                 * no read of the whole register could then avoid.
+                 */
+                sdhci_shadow_add(host, ESDHC_VENDOR_SPEC, 0);
+                if (imx_data->socdata->flags & ESDHC_FLAG_MAN_TUNING)
+                        sdhci_shadow_add(host, ESDHC_MIX_CTRL, 0);
+
                 /* clear tuning bits in case ROM has set it already */
-                writel(0x0, host->ioaddr + ESDHC_MIX_CTRL);
+                sdhci_writel(host, 0x0, ESDHC_MIX_CTRL);
                 writel(0x0, host->ioaddr + SDHCI_ACMD12_ERR);
                 writel(0x0, host->ioaddr + ESDHC_TUNE_CTRL_STATUS);
         }
 
         host->tuning_delay = 1;
 
+        if (imx_data->socdata->flags & ESDHC_FLAG_MAN_TUNING)
+                sdhci_esdhc_ops.platform_execute_tuning =
+                                        esdhc_executing_tuning;
+
+        /* CQE requests bypass .request, wrap the engine's ops as well */
+        if (esdhc_has_pm_holds(imx_data) && host->mmc->cqe_ops)
+                esdhc_pm_hold_cqe(host);
+
+        sdhci_esdhc_imx_hwinit(host);
+
+        err = sdhci_add_host(host);
+        if (err)
+                goto disable_ahb_clk;
+
+        esdhc_debugfs_init(host);
+
+        pm_runtime_set_active(&pdev->dev);
+        pm_runtime_set_autosuspend_delay(&pdev->dev, 50);
+        pm_runtime_use_autosuspend(&pdev->dev);
+        pm_runtime_allow(&pdev->dev);
+        pm_runtime_enable(&pdev->dev);
 
+        return 0;
 
 disable_ahb_clk:
         clk_disable_unprepare(imx_data->clk_ahb);
@@ -409,12 +1556,6 @@ disable_ipg_clk:
         clk_disable_unprepare(imx_data->clk_ipg);
 disable_per_clk:
         clk_disable_unprepare(imx_data->clk_per);
-
-        if (imx_data->socdata->flags & ESDHC_FLAG_BUSFREQ)
-                release_bus_freq(BUS_FREQ_HIGH);
-
-        if (imx_data->socdata->flags & ESDHC_FLAG_PMQOS)
-                pm_qos_remove_request(&imx_data->pm_qos_req);
 free_sdhci:
         sdhci_pltfm_free(pdev);
 	return err;
@@ -427,8 +1568,8 @@ static int sdhci_esdhc_imx_remove(struct platform_device *pdev)
         struct pltfm_imx_data *imx_data = sdhci_pltfm_priv(pltfm_host);
         int dead = (readl(host->ioaddr + SDHCI_INT_STATUS) == 0xffffffff);
 
-        if (imx_data->socdata->flags & ESDHC_FLAG_PMQOS)
-                pm_qos_remove_request(&imx_data->pm_qos_req);
+        esdhc_debugfs_remove(imx_data);
+        esdhc_pm_hold_drop(imx_data);
 
         pm_runtime_get_sync(&pdev->dev);
         pm_runtime_disable(&pdev->dev);
@@ -439,8 +1580,6 @@ static int sdhci_esdhc_imx_remove(struct platform_device *pdev)
         clk_disable_unprepare(imx_data->clk_per);
         clk_disable_unprepare(imx_data->clk_ipg);
         clk_disable_unprepare(imx_data->clk_ahb);
-        if (imx_data->socdata->flags & ESDHC_FLAG_BUSFREQ)
-                release_bus_freq(BUS_FREQ_HIGH);
 
         sdhci_pltfm_free(pdev);
 
@@ -461,6 +1600,13 @@ static void sdhci_esdhc_imx_hwinit(struct sdhci_host *host)
 		 */
 		writel(ESDHC_WTMK_DEFAULT_VAL, host->ioaddr + ESDHC_WTMK_LVL);
 
+		/* Buffer ready only promises a watermark's worth of words */
+		tmp = readl(host->ioaddr + ESDHC_WTMK_LVL);
+		host->pio_rd_burst = (tmp & ESDHC_WTMK_LVL_RD_WML_MASK) >>
+				     ESDHC_WTMK_LVL_RD_WML_SHIFT;
+		host->pio_wr_burst = (tmp & ESDHC_WTMK_LVL_WR_WML_MASK) >>
+				     ESDHC_WTMK_LVL_WR_WML_SHIFT;
+
 		/*
 		 * ROM code will change the bit burst_length_enable setting
 		 * to zero if this usdhc is chosen to boot system. Change
@@ -472,9 +1618,9 @@ static void sdhci_esdhc_imx_hwinit(struct sdhci_host *host)
 		 * advance. And without burst length indicator, AHB INCR
 		 * transfer can only be converted to singles on the AXI side.
 		 */
-		writel(readl(host->ioaddr + SDHCI_HOST_CONTROL)
+		sdhci_writel(host, sdhci_readl(host, SDHCI_HOST_CONTROL)
 			| ESDHC_BURST_LEN_EN_INCR,
-			host->ioaddr + SDHCI_HOST_CONTROL);
+			SDHCI_HOST_CONTROL);
 
 		/* disable DLL_CTRL delay line settings */
 		writel(0x0, host->ioaddr + ESDHC_DLL_CTRL);
@@ -552,6 +1698,8 @@ static int sdhci_esdhc_suspend(struct device *dev)
 
 	ret = sdhci_suspend_host(host);
 
+	esdhc_pm_hold_drop(imx_data);
+
 	pinctrl_pm_select_sleep_state(dev);
 
 	if (!sdhci_sdio_irq_enabled(host)) {
@@ -624,17 +1772,13 @@ static int sdhci_esdhc_runtime_suspend(struct device *dev)
 
 	if (!sdhci_sdio_irq_enabled(host)) {
 		imx_data->actual_clock = host->mmc->actual_clock;
-	//shijon	esdhc_pltfm_set_clock(host, 0);
+		esdhc_pltfm_set_clock(host, 0);
 		clk_disable_unprepare(imx_data->clk_per);
 		clk_disable_unprepare(imx_data->clk_ipg);
 	}
 	clk_disable_unprepare(imx_data->clk_ahb);
 
-	if (imx_data->socdata->flags & ESDHC_FLAG_BUSFREQ)
-		release_bus_freq(BUS_FREQ_HIGH);
-
-	if (imx_data->socdata->flags & ESDHC_FLAG_PMQOS)
-		pm_qos_remove_request(&imx_data->pm_qos_req);
+	esdhc_pm_hold_drop(imx_data);
 
 	return ret;
 }
@@ -650,12 +1794,7 @@ static int sdhci_esdhc_runtime_resume(struct device *dev)
 	if (err)
 		return err;
 
-	if (imx_data->socdata->flags & ESDHC_FLAG_BUSFREQ)
-		request_bus_freq(BUS_FREQ_HIGH);
-
-	if (imx_data->socdata->flags & ESDHC_FLAG_PMQOS)
-		pm_qos_add_request(&imx_data->pm_qos_req,
-			PM_QOS_CPU_DMA_LATENCY, 0);
+	/* bus freq and PM QoS are taken again by the next request */
 
 	if (imx_data->socdata->flags & ESDHC_FLAG_CLK_RATE_LOST_IN_PM_RUNTIME)
 		clk_set_rate(imx_data->clk_per, pltfm_host->clock);
@@ -667,7 +1806,7 @@ static int sdhci_esdhc_runtime_resume(struct device *dev)
 		err = clk_prepare_enable(imx_data->clk_ipg);
 		if (err)
 			goto disable_per_clk;
-	// shijon	esdhc_pltfm_set_clock(host, imx_data->actual_clock);
+		esdhc_pltfm_set_clock(host, imx_data->actual_clock);
 	}
 
 	err = sdhci_runtime_resume_host(host);
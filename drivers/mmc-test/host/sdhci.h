@@ -19,6 +19,9 @@
 #include <linux/io.h>
 #include <linux/leds.h>
 #include <linux/interrupt.h>
+#include <linux/bitops.h>
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
 
 #include <linux/mmc/host.h>
 
@@ -28,6 +31,7 @@
 
 #define SDHCI_DMA_ADDRESS	0x00
 #define SDHCI_ARGUMENT2		SDHCI_DMA_ADDRESS
+#define SDHCI_32BIT_BLK_CNT	SDHCI_DMA_ADDRESS
 
 #define SDHCI_BLOCK_SIZE	0x04
 #define  SDHCI_MAKE_BLKSZ(dma, blksz) (((dma & 0x7) << 12) | (blksz & 0xFFF))
@@ -86,6 +90,7 @@
 #define   SDHCI_CTRL_ADMA1	0x08
 #define   SDHCI_CTRL_ADMA32	0x10
 #define   SDHCI_CTRL_ADMA64	0x18
+#define   SDHCI_CTRL_ADMA3	0x18	/* Version 4 mode */
 #define   SDHCI_CTRL_8BITBUS	0x20
 #define  SDHCI_CTRL_CDTEST_INS	0x40
 #define  SDHCI_CTRL_CDTEST_EN	0x80
@@ -184,6 +189,8 @@
 #define   SDHCI_CTRL_DRV_TYPE_D		0x0030
 #define  SDHCI_CTRL_EXEC_TUNING		0x0040
 #define  SDHCI_CTRL_TUNED_CLK		0x0080
+#define  SDHCI_CTRL_V4_MODE		0x1000
+#define  SDHCI_CTRL_64BIT_ADDR		0x2000
 #define  SDHCI_CTRL_PRESET_VAL_ENABLE	0x8000
 
 #define SDHCI_CAPABILITIES	0x40
@@ -222,6 +229,7 @@
 #define  SDHCI_SUPPORT_HS400	0x80000000 /* Non-standard */
 
 #define SDHCI_CAPABILITIES_1	0x44
+#define  SDHCI_CAN_DO_ADMA3	0x08000000
 
 #define SDHCI_MAX_CURRENT		0x48
 #define  SDHCI_MAX_CURRENT_LIMIT	0xFF
@@ -245,7 +253,7 @@
 #define SDHCI_ADMA_ADDRESS	0x58
 #define SDHCI_ADMA_ADDRESS_HI	0x5C
 
-/* 60-FB reserved */
+/* 60-77 reserved */
 
 #define SDHCI_PRESET_FOR_SDR12 0x66
 #define SDHCI_PRESET_FOR_SDR25 0x68
@@ -260,6 +268,11 @@
 #define SDHCI_PRESET_SDCLK_FREQ_MASK   0x3FF
 #define SDHCI_PRESET_SDCLK_FREQ_SHIFT	0
 
+#define SDHCI_ADMA3_ADDRESS	0x78
+#define SDHCI_ADMA3_ADDRESS_HI	0x7C
+
+/* 80-FB reserved */
+
 #define SDHCI_SLOT_INT_STATUS	0xFC
 
 #define SDHCI_HOST_VERSION	0xFE
@@ -270,6 +283,9 @@
 #define   SDHCI_SPEC_100	0
 #define   SDHCI_SPEC_200	1
 #define   SDHCI_SPEC_300	2
+#define   SDHCI_SPEC_400	3
+#define   SDHCI_SPEC_410	4
+#define   SDHCI_SPEC_420	5
 
 /*
  * End of controller registers.
@@ -319,10 +335,48 @@ struct sdhci_adma2_64_desc {
 	__le32	addr_hi;
 }  __packed __aligned(4);
 
+/* ADMA2 64-bit descriptor size in version 4 mode */
+#define SDHCI_ADMA2_64_DESC_V4_SZ	16
+
 #define ADMA2_TRAN_VALID	0x21
 #define ADMA2_NOP_END_VALID	0x3
 #define ADMA2_END		0x2
 
+/*
+ * ADMA3 command descriptor. Four lines, each an attribute word followed by
+ * the value of one of the registers 0x00-0x0F (32-bit block count, block
+ * size, argument, transfer mode/command) in register order.
+ */
+struct sdhci_adma3_cmd_desc {
+	__le32	cmd;
+	__le32	reg;
+}  __packed __aligned(4);
+
+#define SDHCI_ADMA3_CMD_DESC_LINES	4
+#define SDHCI_ADMA3_CMD_DESC_SZ		(SDHCI_ADMA3_CMD_DESC_LINES * 8)
+
+/*
+ * ADMA3 integrated descriptor line: points at a command descriptor or at
+ * the ADMA2 descriptor table of the command before it.
+ */
+struct sdhci_adma3_id_desc {
+	__le32	cmd;
+	__le32	addr_lo;
+	__le32	addr_hi;
+	__le32	reserved;
+}  __packed __aligned(4);
+
+#define SDHCI_ADMA3_ID_32_DESC_SZ	8
+#define SDHCI_ADMA3_ID_64_DESC_SZ	16
+
+/* One command descriptor plus its two integrated descriptor lines */
+#define SDHCI_ADMA3_TABLE_SZ	(SDHCI_ADMA3_CMD_DESC_SZ + \
+				 2 * SDHCI_ADMA3_ID_64_DESC_SZ)
+
+#define ADMA3_CMD_VALID		0x09
+#define ADMA3_ID_VALID		0x39
+#define ADMA3_END		0x2
+
 /*
  * Maximum segments assuming a 512KiB maximum requisition size and a minimum
  * 4KiB page size.
@@ -346,6 +400,70 @@ enum sdhci_cookie {
 	COOKIE_MAPPED,		/* mapped by sdhci_prepare_data() */
 };
 
+/* Time from the completing interrupt to mmc_request_done() */
+struct sdhci_done_stats {
+	u64	completed;	/* Requests handed back to the core */
+	u64	fast;		/* ... straight from sdhci_irq() */
+	u64	deferred;	/* ... from the IRQ thread */
+	u64	total_ns;
+	u64	max_ns;
+};
+
+/* Transfer sizes the DMA-vs-PIO policy learns about: 4 bytes .. 4KiB */
+#define SDHCI_XFER_BUCKETS	11
+#define SDHCI_XFER_MAX_BYTES	(4 << (SDHCI_XFER_BUCKETS - 1))
+/* Every Nth request in a bucket takes the path currently thought slower */
+#define SDHCI_XFER_EXPLORE	32
+
+/* Host CPU time a request spends on, see sdhci_xfer_account() */
+enum sdhci_xfer_cost {
+	SDHCI_XFER_MAP,
+	SDHCI_XFER_UNMAP,
+	SDHCI_XFER_PIO,
+};
+
+struct sdhci_xfer_bucket {
+	u32	pio_ns;		/* Running average cost, 0 = unknown */
+	u32	map_ns;
+	u32	unmap_ns;
+	u32	pio;		/* Requests that took each path */
+	u32	dma;
+	u32	seq;
+};
+
+struct sdhci_xfer_stats {
+	u64	dma;		/* Data requests moved by (A)DMA */
+	u64	dma_bytes;
+	u64	pio;		/* ... through the buffer data port */
+	u64	pio_bytes;
+};
+
+/*
+ * Copies of control registers that, apart from the bits in vmask, only the
+ * driver changes, so the read half of a read-modify-write does not cost an
+ * uncached bus read. Slots are 32-bit registers; drivers may claim the
+ * vendor slots with sdhci_shadow_add().
+ */
+enum {
+	SDHCI_SHADOW_HOST_CONTROL,	/* + power, block gap, wake-up */
+	SDHCI_SHADOW_CLOCK_CONTROL,	/* + timeout control, reset */
+	SDHCI_SHADOW_INT_ENABLE,
+	SDHCI_SHADOW_SIGNAL_ENABLE,
+	SDHCI_SHADOW_VENDOR,
+	SDHCI_SHADOW_SLOTS = SDHCI_SHADOW_VENDOR + 2,
+};
+
+struct sdhci_shadow {
+	bool		enabled;
+	unsigned long	valid;		/* Slots holding a copy */
+	u8		val[SDHCI_SHADOW_SLOTS * 4];
+	u32		vmask[SDHCI_SHADOW_SLOTS];	/* Hardware-owned bits */
+	int		reg[SDHCI_SHADOW_SLOTS];	/* Vendor slot offsets */
+	unsigned long	hits;
+	unsigned long	fills;
+	unsigned long	mismatches;	/* CONFIG_MMC_DEBUG cross-check */
+};
+
 struct sdhci_host {
 	/* Data set by hardware interface driver */
 	const char *hw_name;	/* Hardware bus name */
@@ -452,6 +570,8 @@ struct sdhci_host {
 #define SDHCI_QUIRK2_DISABLE_HW_TIMEOUT			(1<<17)
 /* Host or Card can't support no thread sdio irq */
 #define SDHCI_QUIRK2_SDIO_IRQ_THREAD			(1<<17)
+/* Controller advertises ADMA3 but it is unusable */
+#define SDHCI_QUIRK2_BROKEN_ADMA3			(1<<18)
 
 	int irq;		/* Device IRQ */
 	void __iomem *ioaddr;	/* Mapped address */
@@ -489,6 +609,8 @@ struct sdhci_host {
 #define SDHCI_SIGNALING_330	(1<<14)	/* Host is capable of 3.3V signaling */
 #define SDHCI_SIGNALING_180	(1<<15)	/* Host is capable of 1.8V signaling */
 #define SDHCI_SIGNALING_120	(1<<16)	/* Host is capable of 1.2V signaling */
+#define SDHCI_USE_ADMA3		(1<<17)	/* Host is ADMA3 capable */
+#define SDHCI_REQ_USE_ADMA3	(1<<18)	/* Use ADMA3 for this req. */
 
 	unsigned int version;	/* SDHCI spec. version */
 
@@ -504,8 +626,10 @@ struct sdhci_host {
 	bool preset_enabled;	/* Preset is enabled */
 	bool pending_reset;	/* Cmd/data reset is pending */
 	bool irq_wake_enabled;	/* IRQ wakeup is enabled */
+	bool v4_mode;		/* Host Version 4 Enable */
 
 	struct mmc_request *mrqs_done[SDHCI_MAX_MRQS];	/* Requests done */
+	ktime_t mrqs_done_stamp[SDHCI_MAX_MRQS];	/* When they were done */
 	struct mmc_command *cmd;	/* Current command */
 	struct mmc_command *data_cmd;	/* Current data command */
 	struct mmc_data *data;	/* Current data request */
@@ -527,7 +651,9 @@ struct sdhci_host {
 
 	unsigned int desc_sz;	/* ADMA descriptor size */
 
-	struct tasklet_struct finish_tasklet;	/* Tasklet structures */
+	void *adma3_table;	/* ADMA3 command + integrated descr. */
+	dma_addr_t adma3_addr;	/* Mapped ADMA3 table */
+	unsigned int adma3_id_sz;	/* ADMA3 integrated descriptor size */
 
 	struct timer_list timer;	/* Timer for timeouts */
 	struct timer_list data_timer;	/* Timer for data timeouts */
@@ -545,6 +671,26 @@ struct sdhci_host {
 
 	u32			thread_isr;
 
+	struct sdhci_shadow	shadow;		/* Control register copies */
+	bool			io_hooks;	/* Holds sdhci_io_accessors */
+
+	bool			irq_holds_lock;	/* Inside sdhci_irq() */
+	ktime_t			irq_stamp;	/* Entry time of sdhci_irq() */
+	struct sdhci_done_stats	done_stats;	/* Completion latency */
+	struct sdhci_xfer_stats	xfer_stats;	/* PIO vs DMA selection */
+	struct sdhci_xfer_bucket xfer_buckets[SDHCI_XFER_BUCKETS];
+	int			pio_threshold;	/* Bytes, -1 = learn per size */
+	unsigned int		xfer_clock;	/* Hz the buckets were learnt at */
+	u64			pio_cost_ns;	/* Copying host->data so far */
+
+	/* Buffer words per watermark burst, 0 = a whole block */
+	unsigned int		pio_rd_burst;
+	unsigned int		pio_wr_burst;
+	/* Where a block stalled on the watermark got to */
+	size_t			pio_blk_left;	/* Bytes, 0 = between blocks */
+	unsigned int		pio_chunk;	/* Bytes held in pio_scratch */
+	u32			pio_scratch;
+
 	/* cached registers */
 	u32			ier;
 
@@ -610,49 +756,59 @@ struct sdhci_ops {
 
 #ifdef CONFIG_MMC_SDHCI_IO_ACCESSORS
 
-static inline void sdhci_writel(struct sdhci_host *host, u32 val, int reg)
+/*
+ * Enabled while any host may have register accessor hooks: every host from
+ * sdhci_alloc_host() until sdhci_setup_host() finds it has none. When it is
+ * off the accessors below compile down to plain MMIO with no ops lookup.
+ */
+DECLARE_STATIC_KEY_FALSE(sdhci_io_accessors);
+
+#define sdhci_io_hooked(hook) \
+	(static_branch_unlikely(&sdhci_io_accessors) && (hook))
+
+static inline void __sdhci_writel(struct sdhci_host *host, u32 val, int reg)
 {
-	if (unlikely(host->ops->write_l))
+	if (sdhci_io_hooked(host->ops->write_l))
 		host->ops->write_l(host, val, reg);
 	else
 		writel(val, host->ioaddr + reg);
 }
 
-static inline void sdhci_writew(struct sdhci_host *host, u16 val, int reg)
+static inline void __sdhci_writew(struct sdhci_host *host, u16 val, int reg)
 {
-	if (unlikely(host->ops->write_w))
+	if (sdhci_io_hooked(host->ops->write_w))
 		host->ops->write_w(host, val, reg);
 	else
 		writew(val, host->ioaddr + reg);
 }
 
-static inline void sdhci_writeb(struct sdhci_host *host, u8 val, int reg)
+static inline void __sdhci_writeb(struct sdhci_host *host, u8 val, int reg)
 {
-	if (unlikely(host->ops->write_b))
+	if (sdhci_io_hooked(host->ops->write_b))
 		host->ops->write_b(host, val, reg);
 	else
 		writeb(val, host->ioaddr + reg);
 }
 
-static inline u32 sdhci_readl(struct sdhci_host *host, int reg)
+static inline u32 __sdhci_readl(struct sdhci_host *host, int reg)
 {
-	if (unlikely(host->ops->read_l))
+	if (sdhci_io_hooked(host->ops->read_l))
 		return host->ops->read_l(host, reg);
 	else
 		return readl(host->ioaddr + reg);
 }
 
-static inline u16 sdhci_readw(struct sdhci_host *host, int reg)
+static inline u16 __sdhci_readw(struct sdhci_host *host, int reg)
 {
-	if (unlikely(host->ops->read_w))
+	if (sdhci_io_hooked(host->ops->read_w))
 		return host->ops->read_w(host, reg);
 	else
 		return readw(host->ioaddr + reg);
 }
 
-static inline u8 sdhci_readb(struct sdhci_host *host, int reg)
+static inline u8 __sdhci_readb(struct sdhci_host *host, int reg)
 {
-	if (unlikely(host->ops->read_b))
+	if (sdhci_io_hooked(host->ops->read_b))
 		return host->ops->read_b(host, reg);
 	else
 		return readb(host->ioaddr + reg);
@@ -660,38 +816,198 @@ static inline u8 sdhci_readb(struct sdhci_host *host, int reg)
 
 #else
 
-static inline void sdhci_writel(struct sdhci_host *host, u32 val, int reg)
+static inline void __sdhci_writel(struct sdhci_host *host, u32 val, int reg)
 {
 	writel(val, host->ioaddr + reg);
 }
 
-static inline void sdhci_writew(struct sdhci_host *host, u16 val, int reg)
+static inline void __sdhci_writew(struct sdhci_host *host, u16 val, int reg)
 {
 	writew(val, host->ioaddr + reg);
 }
 
-static inline void sdhci_writeb(struct sdhci_host *host, u8 val, int reg)
+static inline void __sdhci_writeb(struct sdhci_host *host, u8 val, int reg)
 {
 	writeb(val, host->ioaddr + reg);
 }
 
-static inline u32 sdhci_readl(struct sdhci_host *host, int reg)
+static inline u32 __sdhci_readl(struct sdhci_host *host, int reg)
 {
 	return readl(host->ioaddr + reg);
 }
 
-static inline u16 sdhci_readw(struct sdhci_host *host, int reg)
+static inline u16 __sdhci_readw(struct sdhci_host *host, int reg)
 {
 	return readw(host->ioaddr + reg);
 }
 
-static inline u8 sdhci_readb(struct sdhci_host *host, int reg)
+static inline u8 __sdhci_readb(struct sdhci_host *host, int reg)
 {
 	return readb(host->ioaddr + reg);
 }
 
 #endif /* CONFIG_MMC_SDHCI_IO_ACCESSORS */
 
+static inline bool sdhci_has_io_accessors(struct sdhci_host *host)
+{
+#ifdef CONFIG_MMC_SDHCI_IO_ACCESSORS
+	if (!static_branch_unlikely(&sdhci_io_accessors))
+		return false;
+
+	return host->ops->read_l || host->ops->read_w || host->ops->read_b ||
+	       host->ops->write_l || host->ops->write_w || host->ops->write_b;
+#else
+	return false;
+#endif
+}
+
+#ifdef CONFIG_MMC_DEBUG
+void sdhci_shadow_check(struct sdhci_host *host, int reg, int width, u32 val);
+#else
+static inline void sdhci_shadow_check(struct sdhci_host *host, int reg,
+				      int width, u32 val) {}
+#endif
+
+static inline int sdhci_shadow_slot(struct sdhci_host *host, int reg)
+{
+	int i;
+
+	switch (reg & ~3) {
+	case SDHCI_HOST_CONTROL:
+		return SDHCI_SHADOW_HOST_CONTROL;
+	case SDHCI_CLOCK_CONTROL:
+		return SDHCI_SHADOW_CLOCK_CONTROL;
+	case SDHCI_INT_ENABLE:
+		return SDHCI_SHADOW_INT_ENABLE;
+	case SDHCI_SIGNAL_ENABLE:
+		return SDHCI_SHADOW_SIGNAL_ENABLE;
+	}
+
+	for (i = SDHCI_SHADOW_VENDOR; i < SDHCI_SHADOW_SLOTS; i++)
+		if (host->shadow.reg[i] && host->shadow.reg[i] == (reg & ~3))
+			return i;
+
+	return -1;
+}
+
+static inline u32 sdhci_shadow_mask(int reg, int width)
+{
+	return (width == 4 ? ~0U : BIT(width * 8) - 1) << ((reg & 3) * 8);
+}
+
+/*
+ * Serve a read of a shadowed register from its copy, filling the copy from
+ * the hardware the first time around. Bits the controller changes on its
+ * own always come from the hardware.
+ */
+static inline bool sdhci_shadow_read(struct sdhci_host *host, int reg,
+				     int width, u32 *val)
+{
+	struct sdhci_shadow *shadow = &host->shadow;
+	u8 *bytes;
+	u32 hw;
+	int slot, i;
+
+	if (!shadow->enabled)
+		return false;
+
+	slot = sdhci_shadow_slot(host, reg);
+	if (slot < 0 || (shadow->vmask[slot] & sdhci_shadow_mask(reg, width)))
+		return false;
+
+	bytes = &shadow->val[slot * 4];
+
+	if (!(shadow->valid & BIT(slot))) {
+		hw = __sdhci_readl(host, reg & ~3);
+		for (i = 0; i < 4; i++)
+			bytes[i] = hw >> (i * 8);
+		shadow->valid |= BIT(slot);
+		shadow->fills++;
+	} else {
+		shadow->hits++;
+	}
+
+	*val = 0;
+	for (i = 0; i < width; i++)
+		*val |= (u32)bytes[(reg & 3) + i] << (i * 8);
+
+	sdhci_shadow_check(host, reg, width, *val);
+
+	return true;
+}
+
+/* Register bytes are stored one at a time so writes to neighbours never race */
+static inline void sdhci_shadow_write(struct sdhci_host *host, int reg,
+				      int width, u32 val)
+{
+	struct sdhci_shadow *shadow = &host->shadow;
+	int slot, i;
+
+	if (!shadow->enabled)
+		return;
+
+	slot = sdhci_shadow_slot(host, reg);
+	if (slot < 0)
+		return;
+
+	for (i = 0; i < width; i++)
+		shadow->val[slot * 4 + (reg & 3) + i] = val >> (i * 8);
+}
+
+/* After a reset, or anything else that may have changed the registers */
+static inline void sdhci_shadow_invalidate(struct sdhci_host *host)
+{
+	host->shadow.valid = 0;
+}
+
+static inline void sdhci_writel(struct sdhci_host *host, u32 val, int reg)
+{
+	__sdhci_writel(host, val, reg);
+	sdhci_shadow_write(host, reg, 4, val);
+}
+
+static inline void sdhci_writew(struct sdhci_host *host, u16 val, int reg)
+{
+	__sdhci_writew(host, val, reg);
+	sdhci_shadow_write(host, reg, 2, val);
+}
+
+static inline void sdhci_writeb(struct sdhci_host *host, u8 val, int reg)
+{
+	__sdhci_writeb(host, val, reg);
+	sdhci_shadow_write(host, reg, 1, val);
+}
+
+static inline u32 sdhci_readl(struct sdhci_host *host, int reg)
+{
+	u32 val;
+
+	if (sdhci_shadow_read(host, reg, 4, &val))
+		return val;
+
+	return __sdhci_readl(host, reg);
+}
+
+static inline u16 sdhci_readw(struct sdhci_host *host, int reg)
+{
+	u32 val;
+
+	if (sdhci_shadow_read(host, reg, 2, &val))
+		return val;
+
+	return __sdhci_readw(host, reg);
+}
+
+static inline u8 sdhci_readb(struct sdhci_host *host, int reg)
+{
+	u32 val;
+
+	if (sdhci_shadow_read(host, reg, 1, &val))
+		return val;
+
+	return __sdhci_readb(host, reg);
+}
+
 struct sdhci_host *sdhci_alloc_host(struct device *dev, size_t priv_size);
 void sdhci_free_host(struct sdhci_host *host);
 
@@ -701,6 +1017,7 @@ static inline void *sdhci_priv(struct sdhci_host *host)
 }
 
 void sdhci_card_detect(struct sdhci_host *host);
+int sdhci_shadow_add(struct sdhci_host *host, int reg, u32 vmask);
 void __sdhci_read_caps(struct sdhci_host *host, u16 *ver, u32 *caps,
 		       u32 *caps1);
 int sdhci_setup_host(struct sdhci_host *host);